@@ -292,30 +292,29 @@ class CursesUI:
             self.state.last_message = ""     
             return
 
-        elif t == "wpm":
+        elif t == "scoreboard":
+            # each entry carries only the fields that changed
             data = msg.get("data") or {}
-            uid = data.get("uuid")
-            new_wpm = int(data.get("value") or 0)
-            if not uid:
-                return
+            for entry in data.get("players") or []:
+                uid = entry.get("uuid")
+                if not uid:
+                    continue
 
-            ps = self.state.players.get(uid)
-            if not ps:
-                
-                ps = PlayerState(uuid=uid, name="", wpm=0, progress=0)
+                ps = self.state.players.get(uid)
+                if not ps:
+                    ps = PlayerState(uuid=uid, name="", wpm=0, progress=0)
 
-            
-            new_progress = ps.progress
-            if uid != self.state.me_uuid and self.state.words:
-                new_progress = min(len(self.state.words), ps.progress + 1)
+                new_progress = ps.progress
+                if uid != self.state.me_uuid and "words" in entry:
+                    new_progress = min(len(self.state.words), int(entry["words"]))
 
-            self.state.players[uid] = PlayerState(
-                uuid=uid,
-                name=ps.name,
-                wpm=new_wpm,
-                finished_rank=ps.finished_rank,
-                progress=new_progress,
-            )
+                self.state.players[uid] = PlayerState(
+                    uuid=uid,
+                    name=ps.name,
+                    wpm=int(entry.get("wpm", ps.wpm)),
+                    finished_rank=ps.finished_rank,
+                    progress=new_progress,
+                )
             return
 
         elif t == "completed":
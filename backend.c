@@ -6,123 +6,55 @@
 #include <time.h>
 #include <pthread.h>
 #include "backend.h"
-
-char **words_g;
-int words_len_g;
-
-static int fcount_lines(const char *filename)
-{
-    FILE *file = fopen(filename, "r");
-    if (!file)
-    {
-        perror("***Error trying to opening word list file!");
-        exit(EXIT_FAILURE);
-    }
-    char buf[WORD_MAX_LEN];
-    int count = 0;
-    while (fgets(buf, WORD_MAX_LEN, file))
-        count++;
-    fclose(file);
-    return count;
-}
+#include "rng.h"
+#include "lockprof.h"
+#include "log.h"
 
 void init_words_g(void)
 {
-    int lines = fcount_lines(WORD_FILE);
-    words_len_g = lines;
-
-    FILE *file = fopen(WORD_FILE, "r");
-    if (!file)
-    {
-        perror("***ERROR: failed to open file!");
-        exit(EXIT_FAILURE);
-    }
-
-    words_g = malloc(lines * sizeof(char *));
-    if (!words_g)
+    if (!dict_load(DICT_DEFAULT_NAME, WORD_FILE))
     {
-        perror("***ERROR: failed to allocate words_g!");
-        fclose(file);
+        fprintf(stderr, "***ERROR: failed to load %s!\n", WORD_FILE);
         exit(EXIT_FAILURE);
     }
-
-    char buf[WORD_MAX_LEN];
-    int count = 0;
-
-    while (fgets(buf, WORD_MAX_LEN, file) && count < lines)
-    {
-        buf[strcspn(buf, "\n")] = '\0';
-        words_g[count] = malloc(strlen(buf) + 1);
-        if (!words_g[count])
-        {
-            perror("***ERROR: malloc failed while copying a word");
-            for (int i = 0; i < count; i++)
-                free(words_g[i]);
-            free(words_g);
-            fclose(file);
-            exit(EXIT_FAILURE);
-        }
-        strcpy(words_g[count], buf);
-        count++;
-    }
-    fclose(file);
 }
 
-static char **get_chunk(void)
+// the chunk only holds indices into the dictionary, which is immutable
+// and shared by every session. The same dictionary and seed always give
+// the same words, so a test can be regenerated from its seed alone
+void generate_words(const dict_t *dict, uint64_t seed, uint32_t *chunk, int count)
 {
-    char **chunk = (char **)malloc(WORD_CHUNK * sizeof(char *));
-    if (!chunk)
-    {
-        perror("***ERROR: failed to allocate memory for word chunk!");
-        exit(EXIT_FAILURE);
-    }
-    for (int i = 0; i < WORD_CHUNK; i++)
-    {
-        int random_idx = rand() % words_len_g;
-        const char *tmp = words_g[random_idx];
-        chunk[i] = (char *)malloc(strlen(tmp) + 1);
-        if (!chunk[i])
-        {
-            perror("***ERROR: malloc failed while populating word chunk!");
-            for (int j = 0; j < i; j++)
-                free(chunk[j]);
-            free(chunk);
-            exit(EXIT_FAILURE);
-        }
-        strcpy(chunk[i], tmp);
-    }
-    return chunk;
+    rng_t rng;
+    rng_seed(&rng, seed);
+    for (int i = 0; i < count; i++)
+        chunk[i] = rng_range(&rng, (uint32_t)dict->count);
 }
 
-session_t *create_session(void)
+// fills a claimed slot; joins are refused until the seats are published
+static void init_session(session_t *session, const dict_t *dict, int shard)
 {
-    session_t *session = (session_t *)malloc(sizeof(session_t));
-    if (!session)
-    {
-        perror("***ERROR: failed to initialize typing session!");
-        exit(EXIT_FAILURE);
-    }
-
+    session->shard = shard;
+    session->seated = 0;
     session->has_started = 0;
     session->ended = 0;
-    session->list = get_chunk();
-    session->players_count = 0;
+    // published to the other shards by the seats
+    atomic_store_explicit(&session->dict, dict, memory_order_relaxed);
+    session->seed = rng_next(rng_thread());
+    generate_words(dict, session->seed, session->words, WORD_CHUNK);
+
+    session->chars_prefix[0] = 0;
+    for (int i = 1; i <= WORD_CHUNK; i++)
+        session->chars_prefix[i] = session->chars_prefix[i - 1] + (uint32_t)session_word_len(session, i - 1) + (i > 1 ? 1 : 0);
     session->clock = 0;
     session->start_ts.tv_sec = 0;
     session->start_ts.tv_nsec = 0;
-    session->countdown_running = 0;
-
-    if (pthread_mutex_init(&session->lock, NULL) != 0)
-    {
-        perror("***ERROR: failed to initialize session mutex!");
-        free(session);
-        exit(EXIT_FAILURE);
-    }
+    session->countdown_sec = SESSION_COUNTDOWN_SEC;
+    session->countdown_left = 0;
+    timer_init(&session->timer, NULL, session);
+    timer_init(&session->board_timer, NULL, session);
 
     for (int i = 0; i < MAX_LOBBY_COUNT; i++)
         session->players[i] = NULL;
-
-    return session;
 }
 
 int add_player(session_t *session, client_t *client)
@@ -130,34 +62,42 @@ int add_player(session_t *session, client_t *client)
     if (!session || !client)
         return 0;
 
-    pthread_mutex_lock(&session->lock);
+    // the seat was already reserved by find_free_session, so
+    // a free entry is always there
     for (int i = 0; i < MAX_LOBBY_COUNT; i++)
     {
         if (session->players[i] == NULL)
         {
             session->players[i] = client;
-            session->players_count++;
-            int ret = session->players_count;
-            pthread_mutex_unlock(&session->lock);
-            return ret;
+            client->seat = i;
+            session->seated++;
+            return 1;
         }
     }
-    pthread_mutex_unlock(&session->lock);
     return 0;
 }
 
-static void free_session(session_t *session)
+static inline session_chunk_t *slot_chunk(session_list_t *list, const session_t *session)
 {
-    if (!session)
-        return;
-    for (int i = 0; i < WORD_CHUNK; i++)
-        free(session->list[i]);
-    free(session->list);
-    pthread_mutex_destroy(&session->lock);
-    free(session);
+    return list->chunks[session->slot / SESSION_CHUNK];
+}
+
+static inline uint64_t slot_bit(const session_t *session)
+{
+    return UINT64_C(1) << (session->slot % SESSION_CHUNK);
+}
+
+static inline void set_open(session_list_t *list, session_t *session)
+{
+    atomic_fetch_or(&slot_chunk(list, session)->open, slot_bit(session));
+}
+
+static inline void clear_open(session_list_t *list, session_t *session)
+{
+    atomic_fetch_and(&slot_chunk(list, session)->open, ~slot_bit(session));
 }
 
-session_list_t *create_session_list(void)
+session_list_t *create_session_list(int max_sessions, int lobby_size)
 {
     session_list_t *list = (session_list_t *)malloc(sizeof(session_list_t));
     if (!list)
@@ -165,79 +105,187 @@ session_list_t *create_session_list(void)
         perror("***ERROR: memory allocation failed for session list!");
         exit(EXIT_FAILURE);
     }
-    list->count = 0;
-    if (pthread_mutex_init(&list->lock, NULL) != 0)
+    if (pthread_mutex_init(&list->grow_lock, NULL) != 0)
     {
         perror("***ERROR: failed to initialize session list mutex!");
         free(list);
         exit(EXIT_FAILURE);
     }
-    list->sessions = (session_t **)malloc(MAX_SESSIONS * sizeof(session_t *));
-    if (!list->sessions)
+    for (int i = 0; i < SESSION_CHUNKS_MAX; i++)
+        list->chunks[i] = NULL;
+    atomic_init(&list->nchunks, 0);
+    atomic_init(&list->count, 0);
+
+    if (max_sessions <= 0 || max_sessions > SESSIONS_MAX)
+        max_sessions = SESSIONS_MAX;
+    if (lobby_size < 2 || lobby_size > MAX_LOBBY_COUNT)
+        lobby_size = LOBBY_DEFAULT_SIZE;
+    list->max_sessions = max_sessions;
+    list->lobby_size = lobby_size;
+    return list;
+}
+
+void free_session_list(session_list_t *list)
+{
+    if (!list)
+        return;
+    int nchunks = atomic_load(&list->nchunks);
+    for (int c = 0; c < nchunks; c++)
     {
-        perror("***ERROR: memory allocation failed for session object!");
-        pthread_mutex_destroy(&list->lock);
-        free(list);
-        exit(EXIT_FAILURE);
+        for (int i = 0; i < SESSION_CHUNK; i++)
+        {
+            timer_cancel(&list->chunks[c]->slots[i].timer);
+            timer_cancel(&list->chunks[c]->slots[i].board_timer);
+        }
+        free(list->chunks[c]);
     }
-    for (int i = 0; i < MAX_SESSIONS; i++)
-        list->sessions[i] = NULL;
-    return list;
+    pthread_mutex_destroy(&list->grow_lock);
+    free(list);
 }
 
-int add_session(session_list_t *list, session_t *session)
+// adds a chunk of closed slots, unless somebody else already did or
+// the limit was reached. Chunks are published only once initialized
+static int grow_session_list(session_list_t *list, int seen)
 {
-    if (!list || !session)
+    lock_take(&list->grow_lock, LOCK_SESSION_GROW);
+    int nchunks = atomic_load(&list->nchunks);
+    if (nchunks != seen)
+    {
+        lock_drop(&list->grow_lock);
+        return 1;
+    }
+    if (nchunks * SESSION_CHUNK >= list->max_sessions)
+    {
+        lock_drop(&list->grow_lock);
         return 0;
+    }
 
-    pthread_mutex_lock(&list->lock);
-    if (list->count == MAX_SESSIONS)
+    session_chunk_t *chunk = (session_chunk_t *)malloc(sizeof(session_chunk_t));
+    if (!chunk)
     {
-        pthread_mutex_unlock(&list->lock);
+        perror("***ERROR: memory allocation failed for sessions!");
+        lock_drop(&list->grow_lock);
         return 0;
     }
+    atomic_init(&chunk->used, 0);
+    atomic_init(&chunk->open, 0);
+    for (int i = 0; i < SESSION_CHUNK; i++)
+    {
+        session_t *session = &chunk->slots[i];
+        session->slot = nchunks * SESSION_CHUNK + i;
+        atomic_init(&session->seats, SEATS_CLOSED);
+        atomic_init(&session->dict, NULL);
+        timer_init(&session->timer, NULL, session);
+        timer_init(&session->board_timer, NULL, session);
+    }
 
-    for (int i = 0; i < MAX_SESSIONS; i++)
+    // the last chunk can be partial, its missing slots just look used
+    int avail = list->max_sessions - nchunks * SESSION_CHUNK;
+    if (avail < SESSION_CHUNK)
+        atomic_store(&chunk->used, ~((UINT64_C(1) << avail) - 1));
+
+    list->chunks[nchunks] = chunk;
+    atomic_store(&list->nchunks, nchunks + 1);
+    lock_drop(&list->grow_lock);
+    return 1;
+}
+
+// called by the one that emptied the lobby, once its seats are closed:
+// nobody else can reach it anymore, so the slot can be handed out again.
+// That may be a thread other than the shard of the lobby, whose timers
+// were already stopped by the caller of remove_player giving up the last seat
+static void recycle_session(session_list_t *list, session_t *session)
+{
+    clear_open(list, session);
+    atomic_fetch_sub(&list->count, 1);
+    atomic_fetch_and(&slot_chunk(list, session)->used, ~slot_bit(session));
+}
+
+// reserves a seat unless the lobby is closed or full, and returns
+// the players count including the new one, 0 on failure
+static int reserve_seat(session_list_t *list, session_t *session)
+{
+    int size = list->lobby_size;
+    int seats = atomic_load(&session->seats);
+    do
     {
-        if (!list->sessions[i])
-        {
-            list->sessions[i] = session;
-            list->count++;
-            int idx = i;
-            pthread_mutex_unlock(&list->lock);
-            return idx;
-        }
+        if ((seats & SEATS_CLOSED) || SEATS_COUNT(seats) >= size)
+            return 0;
+    } while (!atomic_compare_exchange_weak(&session->seats, &seats, seats + 1));
+
+    // the one taking the last seat hides the lobby, then checks again
+    // in case somebody left in the meantime and already showed it
+    if (SEATS_COUNT(seats) + 1 == size)
+    {
+        clear_open(list, session);
+        int now = atomic_load(&session->seats);
+        if (!(now & SEATS_CLOSED) && SEATS_COUNT(now) < size)
+            set_open(list, session);
     }
-    pthread_mutex_unlock(&list->lock);
-    return 0;
+    return SEATS_COUNT(seats) + 1;
 }
 
-void remove_session(session_list_t *list, session_t *session)
+// returns the players left; the lobby is recycled when it gets empty
+static int release_seat(session_list_t *list, session_t *session)
 {
-    if (!list || !session)
-        return;
+    int prev = atomic_fetch_sub(&session->seats, 1);
+    int left = SEATS_COUNT(prev) - 1;
 
-    pthread_mutex_lock(&list->lock);
-    if (list->count == 0)
+    if (left == 0)
     {
-        pthread_mutex_unlock(&list->lock);
-        return;
+        // a closed lobby can't be joined, so this is the last one out.
+        // Otherwise the seats get closed only if nobody just joined
+        int expected = 0;
+        if ((prev & SEATS_CLOSED) ||
+            atomic_compare_exchange_strong(&session->seats, &expected, SEATS_CLOSED))
+        {
+            log_write(LOG_DEBUG, session->slot, NULL, "Last player removed, freeing session");
+            recycle_session(list, session);
+        }
+        return 0;
     }
 
-    for (int i = 0; i < MAX_SESSIONS; i++)
+    if (!(prev & SEATS_CLOSED) && SEATS_COUNT(prev) == list->lobby_size)
+        set_open(list, session);
+    return left;
+}
+
+static session_t *claim_session(session_list_t *list, const dict_t *dict, int shard)
+{
+    for (;;)
     {
-        if (list->sessions[i] == session)
+        int nchunks = atomic_load(&list->nchunks);
+        for (int c = 0; c < nchunks; c++)
         {
-            free_session(list->sessions[i]);
-            list->sessions[i] = NULL;
-            list->count--;
-            break;
+            session_chunk_t *chunk = list->chunks[c];
+            uint64_t used = atomic_load(&chunk->used);
+            while (~used)
+            {
+                uint64_t bit = ~used & (used + 1);
+                used = atomic_fetch_or(&chunk->used, bit);
+                if (used & bit)
+                    continue; // somebody else got it first
+
+                session_t *session = &chunk->slots[__builtin_ctzll(bit)];
+                init_session(session, dict, shard);
+                atomic_fetch_add(&list->count, 1);
+
+                // the creator takes the first seat, then the lobby is shown
+                atomic_store(&session->seats, 1);
+                set_open(list, session);
+                return session;
+            }
         }
+        if (!grow_session_list(list, nchunks))
+            return NULL;
     }
-    pthread_mutex_unlock(&list->lock);
 }
 
-session_t *find_free_session(session_list_t *list)
+// only lobbies playing with the requested dictionary are considered.
+// On success a seat is already reserved for the caller, and pcount
+// is set to the players count including it. A new lobby is run by
+// the shard of the caller, an existing one keeps its own
+session_t *find_free_session(session_list_t *list, const dict_t *dict, int shard, int *pcount)
 {
     if (!list)
     {
@@ -245,78 +293,71 @@ session_t *find_free_session(session_list_t *list)
         exit(EXIT_FAILURE);
     }
 
-    pthread_mutex_lock(&list->lock);
-
-    int first_session_available = -1;
-
-    for (int i = 0; i < MAX_SESSIONS; i++)
+    int nchunks = atomic_load(&list->nchunks);
+    for (int c = 0; c < nchunks; c++)
     {
-        if (list->sessions[i])
+        session_chunk_t *chunk = list->chunks[c];
+        uint64_t open = atomic_load(&chunk->open);
+        while (open)
         {
-            pthread_mutex_lock(&list->sessions[i]->lock);
-            if (list->sessions[i]->players_count < MAX_LOBBY_COUNT &&
-                !list->sessions[i]->has_started)
+            session_t *session = &chunk->slots[__builtin_ctzll(open)];
+            open &= open - 1;
+
+            // just a hint, the slot may be recycled under us
+            if (atomic_load_explicit(&session->dict, memory_order_relaxed) != dict)
+                continue;
+
+            int count = reserve_seat(list, session);
+            if (count == 0)
+                continue;
+
+            // the slot could have been recycled for another
+            // dictionary between the check and the reservation
+            if (session->dict != dict)
             {
-                session_t *result = list->sessions[i];
-                pthread_mutex_unlock(&list->sessions[i]->lock);
-                pthread_mutex_unlock(&list->lock);
-                return result;
+                release_seat(list, session);
+                continue;
             }
-            pthread_mutex_unlock(&list->sessions[i]->lock);
+            *pcount = count;
+            return session;
         }
-        if (!list->sessions[i] && first_session_available == -1)
-            first_session_available = i;
-    }
-
-    if (first_session_available != -1)
-    {
-        list->sessions[first_session_available] = create_session();
-        list->count++;
-        session_t *result = list->sessions[first_session_available];
-        pthread_mutex_unlock(&list->lock);
-        return result;
     }
 
-    pthread_mutex_unlock(&list->lock);
-    return NULL;
+    session_t *session = claim_session(list, dict, shard);
+    if (session)
+        *pcount = 1;
+    return session;
 }
 
-void remove_player(session_list_t *list, session_t *session, const char *uuid_str)
+// once the game starts nobody can join anymore
+void session_close_joins(session_list_t *list, session_t *session)
 {
-    if (!list || !session || !uuid_str)
-        return;
-
-    pthread_mutex_lock(&session->lock);
+    atomic_fetch_or(&session->seats, SEATS_CLOSED);
+    clear_open(list, session);
+}
 
-    if (session->players_count == 0)
-    {
-        pthread_mutex_unlock(&session->lock);
-        return;
-    }
+// returns the number of players left in the session: when it
+// returns 0 the session could have been recycled, so the caller must
+// not touch it anymore. The timers of the lobby are the caller's to
+// stop, before giving up the last seat
+int remove_player(session_list_t *list, session_t *session, client_t *client)
+{
+    if (!list || !session || !client)
+        return 0;
 
-    int found = 0;
-    for (int i = 0; i < MAX_LOBBY_COUNT; i++)
+    // the client knows its seat, no need to look for it
+    int found = (client->seat >= 0 && client->seat < MAX_LOBBY_COUNT &&
+                 session->players[client->seat] == client);
+    if (found)
     {
-        if (session->players[i] && strcmp(session->players[i]->uuid, uuid_str) == 0)
-        {
-            session->players[i] = NULL;
-            session->players_count--;
-            found = 1;
-            break;
-        }
+        session->players[client->seat] = NULL;
+        session->seated--;
     }
+    client->seat = -1;
 
-    int is_empty = (session->players_count == 0);
-    int running = session->countdown_running;
-    pthread_mutex_unlock(&session->lock);
-
-    if (found && is_empty)
-    {
-        if (running)
-            pthread_join(session->countdown_tid, NULL);
-        printf("Last player removed, freeing session\n");
-        remove_session(list, session);
-    }
+    if (!found)
+        return SEATS_COUNT(atomic_load(&session->seats));
+    return release_seat(list, session);
 }
 
 int is_correct(const char *target, const char *input)
@@ -329,6 +370,18 @@ static inline double timespec_diff_sec(const struct timespec *a, const struct ti
     return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
 }
 
+static inline int speed_wpm(double chars, double elapsed_s)
+{
+    if (elapsed_s < 1e-3)
+        elapsed_s = 1e-3;
+    double wpm_f = (chars / 5.0) / (elapsed_s / 60.0);
+    if (wpm_f < 0.0)
+        wpm_f = 0.0;
+    return (int)(wpm_f + 0.5);
+}
+
+// characters (spaces included) typed after the first n words, read
+// from the prefix table built with the chunk, so it doesn't depend on n
 int wpm(session_t *session, int correct_words)
 {
     if (!session || !session->has_started || correct_words <= 0)
@@ -337,22 +390,104 @@ int wpm(session_t *session, int correct_words)
     struct timespec now;
     clock_gettime(CLOCK_MONOTONIC, &now);
 
-    double elapsed_s = timespec_diff_sec(&now, &session->start_ts);
-    if (elapsed_s < 1e-3)
-        elapsed_s = 1e-3;
-
     int n = correct_words;
     if (n > WORD_CHUNK)
         n = WORD_CHUNK;
 
-    size_t chars = 0;
-    for (int i = 0; i < n; ++i)
-        chars += strlen(session->list[i]);
-    if (n > 1)
-        chars += (size_t)(n - 1);
+    return speed_wpm(session->chars_prefix[n], timespec_diff_sec(&now, &session->start_ts));
+}
 
-    double wpm_f = (chars / 5.0) / (elapsed_s / 60.0);
-    if (wpm_f < 0.0)
-        wpm_f = 0.0;
-    return (int)(wpm_f + 0.5);
+void metrics_reset(metrics_t *m)
+{
+    memset(m, 0, sizeof(*m));
+}
+
+static void metrics_pop_sample(metrics_t *m)
+{
+    m->base_chars = m->win_chars[m->win_head];
+    m->base_ts = m->win_ts[m->win_head];
+    m->has_base = 1;
+    m->win_head = (m->win_head + 1) % METRICS_WINDOW_SAMPLES;
+    m->win_count--;
+}
+
+// called for every word the player sends: everything is updated
+// incrementally, so the cost doesn't grow with the words typed
+void metrics_on_word(metrics_t *m, const session_t *session, const struct timespec *now,
+                     int input_len, int correct)
+{
+    // words after the first one are preceded by a space
+    m->typed_chars += input_len + (m->attempts > 0 ? 1 : 0);
+    m->attempts++;
+    if (!correct)
+        return;
+
+    m->correct++;
+    int n = m->correct < WORD_CHUNK ? m->correct : WORD_CHUNK;
+    m->correct_chars = session->chars_prefix[n];
+
+    if (m->win_count == METRICS_WINDOW_SAMPLES)
+        metrics_pop_sample(m);
+    int slot = (m->win_head + m->win_count) % METRICS_WINDOW_SAMPLES;
+    m->win_ts[slot] = *now;
+    m->win_chars[slot] = m->correct_chars;
+    m->win_count++;
+}
+
+void metrics_get(metrics_t *m, const session_t *session, const struct timespec *now,
+                 metrics_snapshot_t *out)
+{
+    double elapsed_s = timespec_diff_sec(now, &session->start_ts);
+
+    out->wpm = speed_wpm(m->correct_chars, elapsed_s);
+    out->raw_wpm = speed_wpm(m->typed_chars, elapsed_s);
+    out->accuracy = m->typed_chars > 0 ? (int)(100 * m->correct_chars / m->typed_chars) : 100;
+
+    // the instantaneous speed is measured from the newest sample that
+    // left the window, or from the start of the game if none did yet
+    while (m->win_count > 0 &&
+           timespec_diff_sec(now, &m->win_ts[m->win_head]) > METRICS_WINDOW_SEC)
+        metrics_pop_sample(m);
+
+    long base_chars = m->has_base ? m->base_chars : 0;
+    const struct timespec *base_ts = m->has_base ? &m->base_ts : &session->start_ts;
+    out->instant_wpm = speed_wpm((double)(m->correct_chars - base_chars), timespec_diff_sec(now, base_ts));
+}
+
+void cursor_reset(cursor_t *c)
+{
+    c->len = 0;
+    c->ok = 0;
+}
+
+// applies a single keystroke to the cursor of the player, checking it
+// against the word being typed: printable chars are typed, backspace
+// deletes the last one and a space submits the word, returning
+// CURSOR_SUBMIT. The typed word is then in c->typed, c->len chars
+int cursor_key(cursor_t *c, const session_t *session, int word, char key)
+{
+    if (key == ' ')
+        return c->len > 0 ? CURSOR_SUBMIT : 0;
+
+    if (key == '\b' || key == 0x7f)
+    {
+        if (c->len > 0)
+            c->len--;
+        if (c->ok > c->len)
+            c->ok = c->len;
+        return 0;
+    }
+
+    if ((unsigned char)key < 0x20)
+        return 0;
+
+    // only a prefix that is still right can grow
+    if (c->ok == c->len && word < WORD_CHUNK &&
+        c->len < session_word_len(session, word) &&
+        session_word(session, word)[c->len] == key)
+        c->ok++;
+    if (c->len < WORD_MAX_LEN)
+        c->typed[c->len] = key;
+    c->len++;
+    return 0;
 }
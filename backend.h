@@ -1,63 +1,212 @@
 #pragma once
 #include <pthread.h>
 #include <time.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "reactor.h"
+#include "shard.h"
+#include "linebuf.h"
+#include "outq.h"
+#include "dict.h"
+#include "uuidmap.h"
+#include "event.h"
 
 #define NAME_MAX_LEN      16
-#define MAX_SESSIONS      16
-#define MAX_LOBBY_COUNT   8
+#define MAX_LOBBY_COUNT   32 // upper bound of the lobby size
+#define LOBBY_DEFAULT_SIZE 8
 #define WORD_CHUNK        50
-#define WORD_MAX_LEN      64
 #define WORD_FILE         "word_list.txt"
 #define UUID_LEN          64
 #define SERVER_PORT       9000
-#define MAX_CLIENTS       (MAX_LOBBY_COUNT * MAX_SESSIONS)
+
+// the session table grows one chunk at a time, up to the limit set at startup
+#define SESSION_CHUNK      64
+#define SESSION_CHUNKS_MAX 1024
+#define SESSIONS_MAX       (SESSION_CHUNK * SESSION_CHUNKS_MAX)
 
 #define PLAYER_INACTIVE_KICK_SEC 60
 #define SESSION_HARD_TIMEOUT_SEC 600
+#define SESSION_COUNTDOWN_SEC    10
+
+#define RECONNECT_GRACE_SEC      30
+
+// out of descriptors, the connections in the backlog are accepted again
+// after a while; the error is logged at most once per interval
+#define ACCEPT_RETRY_MS          100
+#define ACCEPT_LOG_INTERVAL_MS   1000
+
+#define COMPLETED_GRACE_SEC      20
+#define COMPLETED_WARNING_SEC    5
+
+#define METRICS_WINDOW_SAMPLES   32
+#define METRICS_WINDOW_SEC       5
+
+#define SCOREBOARD_DEFAULT_HZ    10
+#define SCOREBOARD_MAX_HZ        50
+
+struct session_s;
+
+// per-player typing metrics, updated at every word
+typedef struct metrics_s
+{
+	int attempts;       // words sent, right or wrong
+	int correct;
+	long typed_chars;   // chars of every word sent, spaces included
+	long correct_chars; // chars of the correct words, spaces included
+
+	// correct chars over time, for the speed over the last seconds
+	struct timespec win_ts[METRICS_WINDOW_SAMPLES];
+	long win_chars[METRICS_WINDOW_SAMPLES];
+	int win_head;
+	int win_count;
+	int has_base;
+	long base_chars;
+	struct timespec base_ts;
+} metrics_t;
+
+// streaming input: the current word as the player is typing it
+typedef struct cursor_s
+{
+	char typed[WORD_MAX_LEN];
+	int len;   // chars typed in the word, even past WORD_MAX_LEN
+	int ok;    // length of the typed prefix that matches the word
+} cursor_t;
+
+typedef struct metrics_snapshot_s
+{
+	int wpm;
+	int raw_wpm;     // counting the wrong words too
+	int accuracy;    // percentage of the typed chars that were right
+	int instant_wpm; // over the last METRICS_WINDOW_SEC seconds
+} metrics_snapshot_t;
+
+typedef enum client_state_e
+{
+	CLIENT_HANDSHAKE,  // waiting for the { "name", "uuid" } message
+	CLIENT_IN_SESSION, // in a lobby, either waiting for the game or playing
+	CLIENT_COMPLETED,  // typed every word, waiting for the grace period to end
+	CLIENT_PARKED,     // connection lost mid-session, the seat is kept for a while
+	CLIENT_MOVING,     // being handed over to the shard running its lobby
+	CLIENT_CLOSED
+} client_state_t;
 
 typedef struct client_s
 {
+	reactor_handler_t handler;
+	shard_t *shard;        // the only thread that touches the client
+	shard_msg_t handoff;   // moves the client to another shard
+	int move_to;
 	int socket;
 	char uuid[UUID_LEN];
+	uuid_entry_t uuid_key; // binary uuid, indexes the client once the handshake is done
+	int indexed;
+	int binary;            // speaks the binary protocol after the handshake
 	char name[NAME_MAX_LEN];
 	struct timespec last_activity_ts; 
+	linebuf_t inbuf;
+	outq_t outq;
+
+	client_state_t state;
+	struct session_s *session;
+	int seat;           // index in session->players
+	const dict_t *dict; // dictionary asked for in the handshake
+	int word_counter;
+	int warnings_sent;
+	int lost;           // a send failed on the socket, the player may come back
+	metrics_t metrics;
+	cursor_t cursor;
+	int board_dirty;                // progress to check at the next scoreboard
+	uint64_t dirty_ns;              // when board_dirty was set (latency.h clock)
+	int board_sent[BOARD_FIELDS];   // values the lobby last received
+
+	tw_timer_t idle_timer;  // inactivity kick, re-armed on every word
+	tw_timer_t grace_timer; // warnings and disconnect after completion
+	tw_timer_t close_timer; // deferred close, e.g. of a slow consumer
+	tw_timer_t park_timer;  // gives up the seat of a parked client
+
+	struct client_s *prev;
+	struct client_s *next;
 } client_t;
 
 typedef struct session_s
 {
 	int has_started;
 	int ended;	 
-	char **list; 
-	int players_count;
+	const dict_t *_Atomic dict; // probed by the joiners of any shard
+	uint64_t seed;              // the words are generated from it
+	uint32_t words[WORD_CHUNK]; // indices into dict
+	uint32_t chars_prefix[WORD_CHUNK + 1]; // chars up to the i-th word, spaces included
+	atomic_int seats;           // SEATS_CLOSED flag | players, see find_free_session
+	int slot;                   // index in the session list
+	int shard;                  // runs the lobby, it is the one of its creator
+	int seated;                 // players in players[], the seats also count the ones on their way
 
 	clock_t clock;			  
 	struct timespec start_ts; 
 
-	pthread_t countdown_tid;
-	int countdown_running; 
+	int countdown_sec;  // length of the countdown of this lobby
+	int countdown_left; 
 
-	pthread_mutex_t lock;
+	// ticks the countdown every second, then enforces the hard timeout
+	tw_timer_t timer;
+	tw_timer_t board_timer; // armed when a player makes progress, sends the scoreboard
+
+	// like the game state, only touched by the shard of the lobby
 	client_t *players[MAX_LOBBY_COUNT];
 } session_t;
 
+#define SEATS_CLOSED 0x10000
+#define SEATS_COUNT(s) ((s) & (SEATS_CLOSED - 1))
+
+// the slots are never freed, only recycled, so a lobby can be probed
+// without any lock: a stale read is caught by the seat reservation
+typedef struct session_chunk_s
+{
+	_Atomic uint64_t used;
+	_Atomic uint64_t open; // lobbies that may have a free seat
+	session_t slots[SESSION_CHUNK];
+} session_chunk_t;
+
 typedef struct session_list_s
 {
-	pthread_mutex_t lock;
-	session_t **sessions;
-	int count;
+	session_chunk_t *chunks[SESSION_CHUNKS_MAX];
+	atomic_int nchunks;
+	pthread_mutex_t grow_lock; // only taken to add a chunk
+	int max_sessions;
+	int lobby_size;
+	atomic_int count;
 } session_list_t;
 
 
 void init_words_g(void);
-session_list_t *create_session_list(void);
+void generate_words(const dict_t *dict, uint64_t seed, uint32_t *chunk, int count);
+session_list_t *create_session_list(int max_sessions, int lobby_size);
 void free_session_list(session_list_t *list);
-session_t *find_free_session(session_list_t *list);
-int add_session(session_list_t *list, session_t *session);
-void remove_session(session_list_t *list, session_t *session);
+session_t *find_free_session(session_list_t *list, const dict_t *dict, int shard, int *pcount);
+void session_close_joins(session_list_t *list, session_t *session);
 
-session_t *create_session(void);
 int add_player(session_t *session, client_t *client);
-void remove_player(session_list_t *list, session_t *session, const char *uuid_str);
+int remove_player(session_list_t *list, session_t *session, client_t *client);
+
+static inline const char *session_word(const session_t *session, int i)
+{
+	return dict_word(session->dict, (int)session->words[i]);
+}
+
+static inline int session_word_len(const session_t *session, int i)
+{
+	return dict_word_len(session->dict, (int)session->words[i]);
+}
 
 int is_correct(const char *target, const char *input);
 int wpm(session_t *session, int correct_words);
+
+void metrics_reset(metrics_t *m);
+void metrics_on_word(metrics_t *m, const session_t *session, const struct timespec *now,
+                     int input_len, int correct);
+void metrics_get(metrics_t *m, const session_t *session, const struct timespec *now,
+                 metrics_snapshot_t *out);
+
+#define CURSOR_SUBMIT 1
+void cursor_reset(cursor_t *c);
+int cursor_key(cursor_t *c, const session_t *session, int word, char key);
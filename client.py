@@ -5,11 +5,57 @@ import uuid as uuidlib
 from typing import List, Optional
 
 
+# binary protocol opcodes, see wire.h
+WOP_WORD = 0x01
+WOP_DISCONNECT = 0x02
+WOP_NEW_LOBBY = 0x03
+WOP_KEYS = 0x04
+WOP_SCOREBOARD = 0x81
+WOP_WORDS = 0x82
+WOP_JSON = 0xff
+
+# scoreboard fields, in the order of their bit in the mask
+BOARD_FIELDS = ('words', 'wpm', 'raw', 'accuracy', 'instant', 'char', 'error')
+
+# keystrokes are sent in batches, at most this often
+KEY_BATCH_SEC = 0.05
+
+
+def _varint(value: int) -> bytes:
+    out = bytearray()
+    while True:
+        b = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def _read_varint(buf: bytes, pos: int):
+    value, shift = 0, 0
+    while True:
+        b = buf[pos]
+        pos += 1
+        value |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
 class TypingClient:
 
-    def __init__(self, host: str, port: int):
+    def __init__(self, host: str, port: int, binary: bool = False):
         self.host = host
         self.port = port
+        # with binary set the handshake asks for the binary protocol,
+        # and everything after it is length prefixed frames
+        self.binary = binary
+        self.word_index = 0
+        self.pending_keys = ''
+        self.keys_lock = threading.Lock()
+        self.keys_timer: Optional[threading.Timer] = None
         self.sock: Optional[socket.socket] = None
         self.rfile = None
         self.reader_thread: Optional[threading.Thread] = None
@@ -27,7 +73,10 @@ class TypingClient:
         s.settimeout(None)
         self.sock = s
 
-        self.rfile = s.makefile('r', encoding='utf-8', newline='\n')
+        if self.binary:
+            self.rfile = s.makefile('rb')
+        else:
+            self.rfile = s.makefile('r', encoding='utf-8', newline='\n')
         self.reader_thread = threading.Thread(target=self._reader_loop, daemon=True)
         self.reader_thread.start()
 
@@ -43,6 +92,17 @@ class TypingClient:
             pass
 
 
+    def send_frame(self, op: int, payload: bytes = b''):
+        if not self.sock:
+            return
+
+        body = bytes([op]) + payload
+        try:
+            self.sock.sendall(_varint(len(body)) + body)
+        except BrokenPipeError:
+            pass
+
+
     def close(self):
         self.stop_event.set()
         try:
@@ -58,32 +118,138 @@ class TypingClient:
             pass
 
 
-    def handshake(self, uuid: str, name: str):
+    def handshake(self, uuid: str, name: str, dictionary: Optional[str] = None):
         self.uuid = uuid
         self.name = name
-        self.send_json({
+        msg = {
             'uuid': uuid,
             'name': name
-        })
+        }
+        if dictionary:
+            msg['dict'] = dictionary
+        if self.binary:
+            msg['proto'] = 'bin'
+        self.send_json(msg)
 
     def request_new_lobby(self):
         """NEW: ask server to move us to a new lobby (accepted only after game starts)."""
+        if self.binary:
+            self.send_frame(WOP_NEW_LOBBY)
+            return
         self.send_json({'type': 'new_lobby_request'})
 
     def send_word(self, word: str):
+        if self.binary:
+            # the word is referenced by its index in the list
+            data = word.encode('utf-8')
+            self.send_frame(WOP_WORD, _varint(self.word_index) + _varint(len(data)) + data)
+            self.word_index += 1
+            return
         self.send_json({
             'word': word
         })
 
 
+    def send_keys(self, keys: str):
+        """Streaming input: '\\b' deletes the last char, ' ' submits the word."""
+        if self.binary:
+            data = keys.encode('utf-8')
+            self.send_frame(WOP_KEYS, _varint(len(data)) + data)
+            return
+        self.send_json({'keys': keys})
+
+    def key(self, ch: str):
+        """Queues a keystroke, the queue is flushed every KEY_BATCH_SEC."""
+        with self.keys_lock:
+            self.pending_keys += ch
+            if self.keys_timer is None:
+                self.keys_timer = threading.Timer(KEY_BATCH_SEC, self.flush_keys)
+                self.keys_timer.daemon = True
+                self.keys_timer.start()
+
+    def flush_keys(self):
+        with self.keys_lock:
+            keys, self.pending_keys = self.pending_keys, ''
+            self.keys_timer = None
+        if keys:
+            self.send_keys(keys)
+
+
     def disconnect(self):
+        if self.binary:
+            self.send_frame(WOP_DISCONNECT)
+            return
         self.send_json({
             'type': 'disconnect'
         })
 
 
     # MESSAGE HANDLING
+    def _read_frame(self) -> Optional[bytes]:
+        length, shift = 0, 0
+        while True:
+            b = self.rfile.read(1)
+            if not b:
+                return None
+            length |= (b[0] & 0x7f) << shift
+            shift += 7
+            if not b[0] & 0x80:
+                break
+        body = self.rfile.read(length)
+        return body if len(body) == length else None
+
+
+    def _decode_frame(self, body: bytes) -> Optional[dict]:
+        op, payload = body[0], body[1:]
+        if op == WOP_JSON:
+            return json.loads(payload.decode('utf-8'))
+        if op == WOP_SCOREBOARD:
+            count, pos = _read_varint(payload, 0)
+            players = []
+            for _ in range(count):
+                entry = {'uuid': str(uuidlib.UUID(bytes=payload[pos:pos + 16]))}
+                mask = payload[pos + 16]
+                pos += 17
+                for bit, field in enumerate(BOARD_FIELDS):
+                    if mask & (1 << bit):
+                        entry[field], pos = _read_varint(payload, pos)
+                players.append(entry)
+            return {'type': 'scoreboard', 'data': {'players': players}}
+        if op == WOP_WORDS:
+            count, pos = _read_varint(payload, 0)
+            words = []
+            for _ in range(count):
+                n, pos = _read_varint(payload, pos)
+                words.append(payload[pos:pos + n].decode('utf-8'))
+                pos += n
+            return {'type': 'words', 'data': {'words': words}}
+        return None
+
+
+    def _reader_loop_binary(self):
+        while not self.stop_event.is_set():
+            try:
+                body = self._read_frame()
+            except Exception:
+                break
+
+            if not body:
+                break
+
+            try:
+                msg = self._decode_frame(body)
+            except (ValueError, IndexError):
+                continue
+
+            if msg:
+                self._handle_message(msg)
+
+
     def _reader_loop(self):
+        if self.binary:
+            self._reader_loop_binary()
+            return
+
         while not self.stop_event.is_set():
             try:
                 line = self.rfile.readline()
@@ -121,12 +287,19 @@ class TypingClient:
             print(f"[COUNTDOWN] {data.get('value')}")
         elif mtype == "words":
             self.words = data.get("words", [])
+            self.word_index = 0
             print(f"[WORDS] received {len(self.words)} words")
             # threading.Thread(target=self._demo_autoplay, daemon=True).start()
         elif mtype == "info":
             print(f"[INFO] {message or ''} {('(player=' + str(player) + ')') if player else ''}")
-        elif mtype == "wpm":
-            print(f"[WPM] {data.get('uuid')}: {data.get('value')}")
+        elif mtype == "scoreboard":
+            # only what changed since the previous scoreboard is there
+            for p in data.get('players', []):
+                fields = ' '.join(f"{k}={v}" for k, v in p.items() if k != 'uuid')
+                print(f"[SCOREBOARD] {p.get('uuid')}: {fields}")
+        elif mtype == "resumed":
+            self.word_index = data.get('word_index', 0)
+            print(f"[RESUMED] back at word {data.get('word_index')}")
         elif mtype == "completed":
             print(f"[COMPLETED] {message}")
         elif mtype == "timeout_warning":
@@ -0,0 +1,151 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // MAP_ANONYMOUS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dict.h"
+
+static dict_t dicts_g[DICT_MAX];
+static int dicts_count_g = 0;
+
+// the file is mapped over a slightly bigger anonymous mapping, so the
+// byte right after its end exists (and is 0) even when the file size is
+// a multiple of the page size: the last word is always NUL terminated
+static char *map_file(const char *path, size_t *size, size_t *map_len)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    *size = (size_t)st.st_size;
+    *map_len = *size + 1;
+    char *base = mmap(NULL, *map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    if (mmap(base, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+    {
+        munmap(base, *map_len);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    return base;
+}
+
+const dict_t *dict_load(const char *name, const char *path)
+{
+    if (dicts_count_g == DICT_MAX || strlen(name) >= DICT_NAME_LEN || dict_find(name))
+        return NULL;
+
+    size_t size, map_len;
+    char *arena = map_file(path, &size, &map_len);
+    if (!arena)
+    {
+        perror("***ERROR: failed to map word list file");
+        return NULL;
+    }
+
+    // one byte out of every few is a newline: start the index at a
+    // rough guess of the word count and let it grow if needed
+    size_t cap = size / 6 + 16, count = 0;
+    dict_word_t *index = malloc(cap * sizeof(dict_word_t));
+    if (!index)
+    {
+        munmap(arena, map_len);
+        return NULL;
+    }
+
+    char *p = arena, *end = arena + size;
+    while (p < end)
+    {
+        char *nl = memchr(p, '\n', (size_t)(end - p));
+        if (!nl)
+            nl = end;
+        *nl = '\0';
+
+        size_t len = (size_t)(nl - p);
+        if (len > 0 && p[len - 1] == '\r')
+            p[--len] = '\0';
+
+        // empty lines are skipped, and so are words the clients
+        // would not be able to send back
+        if (len > 0 && len < WORD_MAX_LEN)
+        {
+            if (count == cap)
+            {
+                cap *= 2;
+                dict_word_t *tmp = realloc(index, cap * sizeof(dict_word_t));
+                if (!tmp)
+                {
+                    free(index);
+                    munmap(arena, map_len);
+                    return NULL;
+                }
+                index = tmp;
+            }
+            index[count].off = (uint32_t)(p - arena);
+            index[count].len = (uint32_t)len;
+            count++;
+        }
+        p = nl + 1;
+    }
+
+    if (count == 0)
+    {
+        fprintf(stderr, "***ERROR: word list %s is empty\n", path);
+        free(index);
+        munmap(arena, map_len);
+        return NULL;
+    }
+
+    // the arena won't change anymore
+    mprotect(arena, map_len, PROT_READ);
+
+    dict_t *dict = &dicts_g[dicts_count_g++];
+    strcpy(dict->name, name);
+    dict->arena = arena;
+    dict->map_len = map_len;
+    dict->index = index;
+    dict->count = (int)count;
+    return dict;
+}
+
+const dict_t *dict_find(const char *name)
+{
+    for (int i = 0; i < dicts_count_g; i++)
+        if (strcmp(dicts_g[i].name, name) == 0)
+            return &dicts_g[i];
+    return NULL;
+}
+
+// the first dictionary loaded is the one used when the
+// client doesn't ask for a specific one
+const dict_t *dict_default(void)
+{
+    return dicts_count_g > 0 ? &dicts_g[0] : NULL;
+}
+
+void dict_unload_all(void)
+{
+    for (int i = 0; i < dicts_count_g; i++)
+    {
+        munmap(dicts_g[i].arena, dicts_g[i].map_len);
+        free(dicts_g[i].index);
+    }
+    dicts_count_g = 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define DICT_MAX          8
+#define DICT_NAME_LEN     16
+#define DICT_DEFAULT_NAME "en"
+#define WORD_MAX_LEN      64 // longer words are skipped when loading
+
+typedef struct dict_word_s
+{
+    uint32_t off; // offset of the word in the arena
+    uint32_t len;
+} dict_word_t;
+
+// a word list loaded with a single pass over a private, writable mapping
+// of its file: newlines are turned into terminators in place, so the
+// mapping itself is the arena holding every word, NUL terminated and
+// contiguous, and the index only stores offsets and lengths
+typedef struct dict_s
+{
+    char name[DICT_NAME_LEN];
+    char *arena;
+    size_t map_len;
+    dict_word_t *index;
+    int count;
+} dict_t;
+
+const dict_t *dict_load(const char *name, const char *path);
+const dict_t *dict_find(const char *name);
+const dict_t *dict_default(void);
+void dict_unload_all(void);
+
+static inline const char *dict_word(const dict_t *dict, int i)
+{
+    return dict->arena + dict->index[i].off;
+}
+
+static inline int dict_word_len(const dict_t *dict, int i)
+{
+    return (int)dict->index[i].len;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "event.h"
+
+static _Thread_local evbuf_t evbuf_tls;
+static _Thread_local evbuf_t evbuf_bin_tls;
+
+static evbuf_t *evbuf_reset(evbuf_t *b)
+{
+    if (!b->data)
+    {
+        b->data = malloc(EVBUF_INITIAL_CAP);
+        b->cap = b->data ? EVBUF_INITIAL_CAP : 0;
+    }
+    b->len = 0;
+    b->need_comma = 0;
+    b->oom = (b->data == NULL);
+    return b;
+}
+
+// returns the (emptied) buffer of the calling thread
+evbuf_t *evbuf_get(void)
+{
+    return evbuf_reset(&evbuf_tls);
+}
+
+evbuf_t *evbuf_get_bin(void)
+{
+    return evbuf_reset(&evbuf_bin_tls);
+}
+
+static int reserve(evbuf_t *b, size_t n)
+{
+    if (b->oom)
+        return 0;
+    if (b->len + n <= b->cap)
+        return 1;
+
+    size_t cap = b->cap ? b->cap : EVBUF_INITIAL_CAP;
+    while (cap < b->len + n)
+        cap *= 2;
+    char *data = realloc(b->data, cap);
+    if (!data)
+    {
+        b->oom = 1;
+        return 0;
+    }
+    b->data = data;
+    b->cap = cap;
+    return 1;
+}
+
+static void put(evbuf_t *b, const char *s, size_t n)
+{
+    if (!reserve(b, n))
+        return;
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+}
+
+static void put_char(evbuf_t *b, char c)
+{
+    if (!reserve(b, 1))
+        return;
+    b->data[b->len++] = c;
+}
+
+void ev_bytes(evbuf_t *b, const void *data, size_t len)
+{
+    put(b, (const char *)data, len);
+}
+
+// formatted straight into the buffer, growing it when the text doesn't fit
+void ev_printf(evbuf_t *b, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    int n = reserve(b, 64) ? vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap) : -1;
+    va_end(ap);
+    if (n < 0)
+        return;
+    if ((size_t)n >= b->cap - b->len)
+    {
+        if (!reserve(b, (size_t)n + 1))
+            return;
+        va_start(ap, fmt);
+        vsnprintf(b->data + b->len, b->cap - b->len, fmt, ap);
+        va_end(ap);
+    }
+    b->len += (size_t)n;
+}
+
+// LEB128: 7 bits per byte, the high bit set on all bytes but the last
+void ev_varint(evbuf_t *b, uint64_t value)
+{
+    char tmp[10];
+    size_t n = 0;
+    do
+    {
+        tmp[n] = (char)(value & 0x7f);
+        value >>= 7;
+        if (value)
+            tmp[n] |= (char)0x80;
+        n++;
+    } while (value);
+    put(b, tmp, n);
+}
+
+static void put_escaped_n(evbuf_t *b, const char *s, size_t len)
+{
+    put_char(b, '"');
+    const char *run = s, *end = s + len;
+    for (; s < end; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c != '"' && c != '\\' && c >= 0x20)
+            continue;
+
+        put(b, run, (size_t)(s - run));
+        run = s + 1;
+        switch (c)
+        {
+        case '"':  put(b, "\\\"", 2); break;
+        case '\\': put(b, "\\\\", 2); break;
+        case '\n': put(b, "\\n", 2); break;
+        case '\r': put(b, "\\r", 2); break;
+        case '\t': put(b, "\\t", 2); break;
+        default:
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            put(b, esc, 6);
+        }
+        }
+    }
+    put(b, run, (size_t)(s - run));
+    put_char(b, '"');
+}
+
+static void put_escaped(evbuf_t *b, const char *s)
+{
+    put_escaped_n(b, s, strlen(s));
+}
+
+static void put_key(evbuf_t *b, const char *key)
+{
+    if (b->need_comma)
+        put_char(b, ',');
+    if (key)
+    {
+        put_escaped(b, key);
+        put_char(b, ':');
+    }
+}
+
+void ev_obj_open(evbuf_t *b, const char *key)
+{
+    put_key(b, key);
+    put_char(b, '{');
+    b->need_comma = 0;
+}
+
+void ev_obj_close(evbuf_t *b)
+{
+    put_char(b, '}');
+    b->need_comma = 1;
+}
+
+void ev_arr_open(evbuf_t *b, const char *key)
+{
+    put_key(b, key);
+    put_char(b, '[');
+    b->need_comma = 0;
+}
+
+void ev_arr_close(evbuf_t *b)
+{
+    put_char(b, ']');
+    b->need_comma = 1;
+}
+
+void ev_str(evbuf_t *b, const char *key, const char *value)
+{
+    put_key(b, key);
+    put_escaped(b, value);
+    b->need_comma = 1;
+}
+
+// same as ev_str, for values whose length is already known
+void ev_strn(evbuf_t *b, const char *key, const char *value, size_t len)
+{
+    put_key(b, key);
+    put_escaped_n(b, value, len);
+    b->need_comma = 1;
+}
+
+void ev_int(evbuf_t *b, const char *key, long value)
+{
+    char num[24];
+    int n = snprintf(num, sizeof(num), "%ld", value);
+    put_key(b, key);
+    put(b, num, (size_t)n);
+    b->need_comma = 1;
+}
+
+void event_begin(evbuf_t *b, const char *type, const char *player, const char *message)
+{
+    ev_obj_open(b, NULL);
+    if (type)
+        ev_str(b, "type", type);
+    if (player)
+        ev_str(b, "player", player);
+    if (message)
+        ev_str(b, "message", message);
+}
+
+void event_end(evbuf_t *b)
+{
+    ev_obj_close(b);
+    put_char(b, '\n');
+}
+
+evbuf_t *event_simple(const char *type, const char *player, const char *message)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, type, player, message);
+    event_end(b);
+    return b;
+}
+
+evbuf_t *event_with_uuid(const char *type, const char *player, const char *message, const char *uuid)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, type, player, message);
+    ev_obj_open(b, "data");
+    ev_str(b, "uuid", uuid);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
+
+evbuf_t *event_countdown(int value)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, "countdown", NULL, NULL);
+    ev_obj_open(b, "data");
+    ev_int(b, "value", value);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
+
+evbuf_t *event_timeout_warning(int remaining)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, "timeout_warning", NULL, NULL);
+    ev_obj_open(b, "data");
+    ev_int(b, "remaining", remaining);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
+
+// sent to a player that reconnected, after the lobby and the words
+evbuf_t *event_resumed(const char *uuid, int word_index)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, "resumed", NULL, "Reconnected to your session");
+    ev_obj_open(b, "data");
+    ev_str(b, "uuid", uuid);
+    ev_int(b, "word_index", word_index);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
+
+evbuf_t *event_words(const dict_t *dict, const uint32_t *words, int count)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, "words", NULL, NULL);
+    ev_obj_open(b, "data");
+    ev_arr_open(b, "words");
+    for (int i = 0; i < count; i++)
+        ev_strn(b, NULL, dict_word(dict, (int)words[i]), (size_t)dict_word_len(dict, (int)words[i]));
+    ev_arr_close(b);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
+
+static const char *board_names[BOARD_FIELDS] = {
+    "words", "wpm", "raw", "accuracy", "instant", "char", "error",
+};
+
+evbuf_t *event_scoreboard(const event_board_t *players, int count)
+{
+    evbuf_t *b = evbuf_get();
+    event_begin(b, "scoreboard", NULL, NULL);
+    ev_obj_open(b, "data");
+    ev_arr_open(b, "players");
+    for (int i = 0; i < count; i++)
+    {
+        ev_obj_open(b, NULL);
+        ev_str(b, "uuid", players[i].uuid);
+        for (int f = 0; f < BOARD_FIELDS; f++)
+            if (players[i].mask & (1u << f))
+                ev_int(b, board_names[f], players[i].values[f]);
+        ev_obj_close(b);
+    }
+    ev_arr_close(b);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
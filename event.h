@@ -0,0 +1,72 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "dict.h"
+
+// outbound events are written as JSON lines straight into a byte buffer,
+// without building a cJSON tree. Every thread owns one buffer which is
+// reused for every event, so encoding doesn't allocate once it has grown
+// to fit the biggest event (the words list)
+#define EVBUF_INITIAL_CAP 4096
+
+typedef struct evbuf_s
+{
+    char *data;
+    size_t len;
+    size_t cap;
+    int need_comma;
+    int oom; // set when growing failed, the content must not be sent
+} evbuf_t;
+
+evbuf_t *evbuf_get(void);
+
+// a second per-thread buffer for the binary encoding of an event
+// (see wire.h), so that both encodings can be alive at the same time
+evbuf_t *evbuf_get_bin(void);
+void ev_bytes(evbuf_t *b, const void *data, size_t len);
+void ev_varint(evbuf_t *b, uint64_t value);
+void ev_printf(evbuf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// low level writer, each value is preceded by a comma when needed
+void ev_obj_open(evbuf_t *b, const char *key);
+void ev_obj_close(evbuf_t *b);
+void ev_arr_open(evbuf_t *b, const char *key);
+void ev_arr_close(evbuf_t *b);
+void ev_str(evbuf_t *b, const char *key, const char *value);
+void ev_strn(evbuf_t *b, const char *key, const char *value, size_t len);
+void ev_int(evbuf_t *b, const char *key, long value);
+
+// { "type": ..., "player": ..., "message": ... [, "data": {...}] }\n
+// NULL fields are omitted; between begin and end the caller
+// can open the data object and fill it
+void event_begin(evbuf_t *b, const char *type, const char *player, const char *message);
+void event_end(evbuf_t *b);
+
+// one player in a scoreboard event: only the fields in mask are sent,
+// the others didn't change since the previous scoreboard of the lobby
+#define BOARD_WORDS    0x01 // words completed
+#define BOARD_WPM      0x02
+#define BOARD_RAW      0x04
+#define BOARD_ACCURACY 0x08
+#define BOARD_INSTANT  0x10
+#define BOARD_CHAR     0x20 // chars typed in the current word (streaming input)
+#define BOARD_ERROR    0x40 // the typed chars don't match the word
+#define BOARD_FIELDS   7
+#define BOARD_ALL      ((1u << BOARD_FIELDS) - 1)
+
+typedef struct event_board_s
+{
+    const char *uuid;
+    const unsigned char *uuid_bin; // 16 bytes, for the binary encoding
+    unsigned mask;
+    int values[BOARD_FIELDS];      // indexed by the bit of the field
+} event_board_t;
+
+// complete events, all of them are encoded into the per-thread buffer
+evbuf_t *event_simple(const char *type, const char *player, const char *message);
+evbuf_t *event_with_uuid(const char *type, const char *player, const char *message, const char *uuid);
+evbuf_t *event_countdown(int value);
+evbuf_t *event_timeout_warning(int remaining);
+evbuf_t *event_resumed(const char *uuid, int word_index);
+evbuf_t *event_words(const dict_t *dict, const uint32_t *words, int count);
+evbuf_t *event_scoreboard(const event_board_t *players, int count);
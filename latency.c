@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include "latency.h"
+
+_Thread_local lat_set_t *lat_tls = NULL;
+
+static lat_set_t *_Atomic sets_g[LAT_THREADS_MAX];
+static atomic_int nsets_g = 0;
+static lat_set_t overflow_g; // shared by the threads without a set, never read
+
+static const char *stage_names[LAT_STAGES] = {
+    [LAT_RECV] = "recv",
+    [LAT_PARSE] = "parse",
+    [LAT_CHECK] = "check",
+    [LAT_BOARD_WAIT] = "board_wait",
+    [LAT_ENCODE] = "encode",
+    [LAT_SEND] = "send",
+};
+
+lat_set_t *lat_attach(void)
+{
+    int i = atomic_fetch_add(&nsets_g, 1);
+    lat_set_t *s = i < LAT_THREADS_MAX ? aligned_alloc(_Alignof(lat_set_t), sizeof(lat_set_t)) : NULL;
+    if (s)
+    {
+        memset(s, 0, sizeof(*s));
+        atomic_store_explicit(&sets_g[i], s, memory_order_release);
+    }
+    lat_tls = s ? s : &overflow_g;
+    return lat_tls;
+}
+
+// a plain copy of the histograms of every thread added up
+typedef struct lat_snap_s
+{
+    uint64_t count[LAT_BUCKETS];
+    uint64_t sum;
+    uint64_t total;
+} lat_snap_t;
+
+static void merge(lat_snap_t *out)
+{
+    memset(out, 0, sizeof(lat_snap_t) * LAT_STAGES);
+
+    int n = atomic_load(&nsets_g);
+    if (n > LAT_THREADS_MAX)
+        n = LAT_THREADS_MAX;
+    for (int i = 0; i < n; i++)
+    {
+        lat_set_t *s = atomic_load_explicit(&sets_g[i], memory_order_acquire);
+        if (!s)
+            continue;
+        for (int st = 0; st < LAT_STAGES; st++)
+        {
+            for (int k = 0; k < LAT_BUCKETS; k++)
+                out[st].count[k] += atomic_load_explicit(&s->h[st].count[k], memory_order_relaxed);
+            out[st].sum += atomic_load_explicit(&s->h[st].sum, memory_order_relaxed);
+        }
+    }
+    for (int st = 0; st < LAT_STAGES; st++)
+        for (int k = 0; k < LAT_BUCKETS; k++)
+            out[st].total += out[st].count[k];
+}
+
+// the highest value a bucket holds, so percentiles are never underestimated
+static uint64_t bucket_high(int i)
+{
+    if (i < LAT_SUB)
+        return (uint64_t)i;
+    int shift = i / LAT_SUB - 1;
+    uint64_t low = (uint64_t)(LAT_SUB + i % LAT_SUB) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static uint64_t percentile(const lat_snap_t *h, double q)
+{
+    if (h->total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * (double)h->total);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int k = 0; k < LAT_BUCKETS; k++)
+    {
+        seen += h->count[k];
+        if (seen >= rank)
+            return bucket_high(k);
+    }
+    return bucket_high(LAT_BUCKETS - 1);
+}
+
+static uint64_t highest(const lat_snap_t *h)
+{
+    for (int k = LAT_BUCKETS - 1; k >= 0; k--)
+        if (h->count[k])
+            return bucket_high(k);
+    return 0;
+}
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+#define NQUANTILES (int)(sizeof(quantiles) / sizeof(quantiles[0]))
+
+void lat_render(evbuf_t *b)
+{
+    // the admin shard is the only one rendering
+    static lat_snap_t snap[LAT_STAGES];
+    merge(snap);
+
+    ev_printf(b, "# HELP typel_stage_seconds Latency of the stages of the word pipeline.\n"
+                 "# TYPE typel_stage_seconds summary\n");
+    for (int st = 0; st < LAT_STAGES; st++)
+    {
+        for (int q = 0; q < NQUANTILES; q++)
+            ev_printf(b, "typel_stage_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n", stage_names[st],
+                      quantiles[q], (double)percentile(&snap[st], quantiles[q]) / 1e9);
+        ev_printf(b, "typel_stage_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[st], (double)snap[st].sum / 1e9);
+        ev_printf(b, "typel_stage_seconds_count{stage=\"%s\"} %llu\n", stage_names[st],
+                  (unsigned long long)snap[st].total);
+    }
+}
+
+void lat_dump(evbuf_t *b)
+{
+    static lat_snap_t prev[LAT_STAGES];
+    static lat_snap_t cur[LAT_STAGES];
+    merge(cur);
+
+    ev_printf(b, "%-12s %10s %10s %10s %10s %10s %10s %10s   (us)\n", "stage", "count", "mean", "p50", "p90",
+              "p99", "p999", "max");
+    for (int st = 0; st < LAT_STAGES; st++)
+    {
+        lat_snap_t d;
+        for (int k = 0; k < LAT_BUCKETS; k++)
+            d.count[k] = cur[st].count[k] - prev[st].count[k];
+        d.sum = cur[st].sum - prev[st].sum;
+        d.total = cur[st].total - prev[st].total;
+
+        double mean = d.total ? (double)d.sum / (double)d.total : 0;
+        ev_printf(b, "%-12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stage_names[st],
+                  (unsigned long long)d.total, mean / 1e3, percentile(&d, 0.5) / 1e3, percentile(&d, 0.9) / 1e3,
+                  percentile(&d, 0.99) / 1e3, percentile(&d, 0.999) / 1e3, highest(&d) / 1e3);
+    }
+    memcpy(prev, cur, sizeof(prev));
+}
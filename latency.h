@@ -0,0 +1,90 @@
+#pragma once
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "event.h"
+
+// latency of the stages of the word pipeline, in fixed-size log-linear
+// histograms (HDR style): values under LAT_SUB ns get a bucket each,
+// then every power of two is split in LAT_SUB buckets, so a bucket is
+// at most 1/LAT_SUB wide relative to its values. Values over 2^LAT_MAX_BITS
+// ns (~68s) land in the last bucket. Like the counters of stats.h, every
+// thread records into histograms of its own, merged when read
+#define LAT_SUB_BITS    4
+#define LAT_SUB         (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS    36
+#define LAT_BUCKETS     ((LAT_MAX_BITS - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_THREADS_MAX 128
+
+typedef enum lat_stage_e
+{
+    LAT_RECV,       // one read from a client socket
+    LAT_PARSE,      // decoding a message, JSON or frame
+    LAT_CHECK,      // checking a word and updating the speeds
+    LAT_BOARD_WAIT, // from the progress of a player to the tick sending it
+    LAT_ENCODE,     // building and encoding a scoreboard
+    LAT_SEND,       // handing an event to one recipient
+    LAT_STAGES
+} lat_stage_t;
+
+typedef struct lat_hist_s
+{
+    _Atomic uint64_t count[LAT_BUCKETS];
+    _Atomic uint64_t sum; // ns
+} lat_hist_t;
+
+typedef struct lat_set_s
+{
+    _Alignas(64) lat_hist_t h[LAT_STAGES];
+} lat_set_t;
+
+extern _Thread_local lat_set_t *lat_tls;
+lat_set_t *lat_attach(void);
+
+static inline uint64_t lat_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline int lat_bucket(uint64_t ns)
+{
+    if (ns < LAT_SUB)
+        return (int)ns;
+    int msb = 63 - __builtin_clzll(ns);
+    if (msb >= LAT_MAX_BITS)
+        return LAT_BUCKETS - 1;
+    int shift = msb - LAT_SUB_BITS;
+    return (shift + 1) * LAT_SUB + (int)((ns >> shift) & (LAT_SUB - 1));
+}
+
+// the histograms of a thread are only written by it: no atomic add
+static inline void lat_record(lat_stage_t stage, uint64_t ns)
+{
+    lat_set_t *s = lat_tls ? lat_tls : lat_attach();
+    if (!s)
+        return;
+    lat_hist_t *h = &s->h[stage];
+    _Atomic uint64_t *c = &h->count[lat_bucket(ns)];
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&h->sum, atomic_load_explicit(&h->sum, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+}
+
+// records the time since *start, which moves to now: consecutive
+// stages can be chained with a single clock read each
+static inline void lat_lap(lat_stage_t stage, uint64_t *start)
+{
+    uint64_t now = lat_now();
+    lat_record(stage, now - *start);
+    *start = now;
+}
+
+// Prometheus summaries since the start, for the statistics endpoint,
+// from a single thread
+void lat_render(evbuf_t *b);
+
+// a table of the percentiles since the previous dump (or the start),
+// from a single thread
+void lat_dump(evbuf_t *b);
@@ -0,0 +1,139 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <sys/uio.h>
+#include "linebuf.h"
+
+void linebuf_init(linebuf_t *lb)
+{
+    lb->head = 0;
+    lb->len = 0;
+    lb->scanned = 0;
+}
+
+// fills the free space of the ring (at most two regions) with a single
+// readv. Returns the readv result, or 0 with errno untouched when there is
+// no space left: the caller must check linebuf_full in that case
+ssize_t linebuf_recv(linebuf_t *lb, int fd)
+{
+    size_t free_space = LINEBUF_SIZE - lb->len;
+    if (free_space == 0)
+        return 0;
+
+    // an empty ring can always restart from the beginning
+    if (lb->len == 0)
+        lb->head = 0;
+
+    size_t tail = (lb->head + lb->len) % LINEBUF_SIZE;
+    struct iovec iov[2];
+    int iovcnt = 1;
+
+    iov[0].iov_base = lb->data + tail;
+    if (tail >= lb->head)
+    {
+        iov[0].iov_len = LINEBUF_SIZE - tail;
+        if (lb->head > 0)
+        {
+            iov[1].iov_base = lb->data;
+            iov[1].iov_len = lb->head;
+            iovcnt = 2;
+        }
+    }
+    else
+    {
+        iov[0].iov_len = lb->head - tail;
+    }
+
+    ssize_t n = readv(fd, iov, iovcnt);
+    if (n > 0)
+        lb->len += (size_t)n;
+    return n;
+}
+
+// extracts the next complete line, without the trailing "\n" (or "\r\n"),
+// as a NUL terminated string. The returned pointer is either inside the
+// ring or scratch (which must hold LINEBUF_SIZE bytes) and is valid until
+// the next call. Returns 1 if a line was found, 0 otherwise
+int linebuf_next(linebuf_t *lb, char **line, char *scratch)
+{
+    size_t i;
+    for (i = lb->scanned; i < lb->len; i++)
+        if (lb->data[(lb->head + i) % LINEBUF_SIZE] == '\n')
+            break;
+
+    if (i == lb->len)
+    {
+        lb->scanned = lb->len;
+        return 0;
+    }
+
+    size_t line_len = i;
+    if (lb->head + line_len < LINEBUF_SIZE)
+    {
+        // the common case: the line is contiguous and the
+        // newline itself becomes the string terminator
+        *line = lb->data + lb->head;
+        lb->data[lb->head + line_len] = '\0';
+    }
+    else
+    {
+        size_t first = LINEBUF_SIZE - lb->head;
+        memcpy(scratch, lb->data + lb->head, first);
+        memcpy(scratch + first, lb->data, line_len - first);
+        scratch[line_len] = '\0';
+        *line = scratch;
+    }
+
+    if (line_len > 0 && (*line)[line_len - 1] == '\r')
+        (*line)[line_len - 1] = '\0';
+
+    lb->head = (lb->head + line_len + 1) % LINEBUF_SIZE;
+    lb->len -= line_len + 1;
+    lb->scanned = 0;
+    return 1;
+}
+
+// same as linebuf_next, for a frame prefixed by its varint length (the
+// binary protocol). The frame is not terminated, its length is returned
+// in len. Returns 1 if a frame was found, 0 if more data is needed, -1
+// if the prefix is malformed or announces a frame that can never fit
+int linebuf_next_frame(linebuf_t *lb, unsigned char **frame, size_t *len, char *scratch)
+{
+    size_t value = 0;
+    size_t hdr = 0;
+    for (;;)
+    {
+        if (hdr == lb->len)
+            return 0;
+        if (hdr == 3) // LINEBUF_SIZE takes two bytes at most
+            return -1;
+        unsigned char c = (unsigned char)lb->data[(lb->head + hdr) % LINEBUF_SIZE];
+        value |= (size_t)(c & 0x7f) << (7 * hdr);
+        hdr++;
+        if (!(c & 0x80))
+            break;
+    }
+
+    if (value == 0 || hdr + value > LINEBUF_SIZE)
+        return -1;
+    if (hdr + value > lb->len)
+        return 0;
+
+    size_t start = (lb->head + hdr) % LINEBUF_SIZE;
+    if (start + value <= LINEBUF_SIZE)
+    {
+        *frame = (unsigned char *)lb->data + start;
+    }
+    else
+    {
+        size_t first = LINEBUF_SIZE - start;
+        memcpy(scratch, lb->data + start, first);
+        memcpy(scratch + first, lb->data, value - first);
+        *frame = (unsigned char *)scratch;
+    }
+    *len = value;
+
+    lb->head = (lb->head + hdr + value) % LINEBUF_SIZE;
+    lb->len -= hdr + value;
+    lb->scanned = 0;
+    return 1;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stddef.h>
+#include <sys/types.h>
+
+// per-connection receive ring buffer with newline framing. Data is read
+// straight into the free space of the ring, and every complete line can be
+// extracted in place; only lines wrapping around the end are copied
+#define LINEBUF_SIZE 2048
+
+typedef struct linebuf_s
+{
+    size_t head;    // offset of the first unread byte
+    size_t len;     // bytes currently buffered
+    size_t scanned; // bytes after head already known not to contain '\n'
+    char data[LINEBUF_SIZE];
+} linebuf_t;
+
+void linebuf_init(linebuf_t *lb);
+ssize_t linebuf_recv(linebuf_t *lb, int fd);
+int linebuf_next(linebuf_t *lb, char **line, char *scratch);
+int linebuf_next_frame(linebuf_t *lb, unsigned char **frame, size_t *len, char *scratch);
+
+static inline int linebuf_full(const linebuf_t *lb)
+{
+    return lb->len == LINEBUF_SIZE;
+}
@@ -0,0 +1,718 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <uuid/uuid.h>
+#include <cjson/cJSON.h>
+#include "reactor.h"
+#include "linebuf.h"
+#include "event.h"
+#include "wire.h"
+
+// load generator: opens many simulated players, each one doing the
+// handshake and typing the words of its lobby at a fixed speed, then
+// reports how the server held up. Every player sends only correct
+// words, and the latency of a word is measured from its submission to
+// the first scoreboard of the lobby counting it
+#define BOT_WORDS_MAX  64   // the server sends WORD_CHUNK of them
+#define BOT_OUT_MAX    512
+#define RAMP_TICK_MS   10
+
+typedef enum bot_state_e
+{
+    BOT_CONNECTING,
+    BOT_HANDSHAKE, // waiting for the lobby
+    BOT_LOBBY,     // waiting for the words
+    BOT_PLAYING,
+    BOT_DONE,
+    BOT_FAILED
+} bot_state_t;
+
+typedef struct bot_s
+{
+    reactor_handler_t handler;
+    int id;
+    bot_state_t state;
+    uuid_t uuid;
+    char uuid_str[37];
+    linebuf_t inbuf;
+
+    char out[BOT_OUT_MAX]; // what the socket didn't take yet
+    size_t out_len;
+
+    char words[LINEBUF_SIZE]; // the words, one after the other
+    int word_off[BOT_WORDS_MAX + 1];
+    int nwords;
+    int next_word;
+    int acked;     // words counted by a scoreboard so far
+    int completed; // the server has seen every word
+    uint64_t sent_ns[BOT_WORDS_MAX];
+    uint64_t connect_ns;
+
+    tw_timer_t type_timer;
+} bot_t;
+
+// growable array of samples, sorted once at the end for the percentiles
+typedef struct samples_s
+{
+    uint32_t *v; // microseconds
+    size_t len;
+    size_t cap;
+} samples_t;
+
+static struct
+{
+    const char *host;
+    int port;
+    int clients;
+    int wpm;
+    int rate;     // new connections per second, 0 for all at once
+    int binary;
+    int timeout_sec;
+    int server_pid;
+} opt_g = {"127.0.0.1", 9000, 1000, 60, 0, 0, 120, 0};
+
+static struct
+{
+    int opened;
+    int established;
+    int completed;
+    int failed;
+    long msgs_in;
+    long msgs_out;
+    long bytes_in;
+    samples_t connect_lat;
+    samples_t word_lat;
+    uint64_t start_ns;
+    uint64_t first_lobby_ns;
+    uint64_t last_lobby_ns;
+} stats_g;
+
+static reactor_t reactor_g;
+static bot_t *bots_g;
+static struct sockaddr_storage addr_g;
+static socklen_t addr_len_g;
+static tw_timer_t ramp_timer_g;
+static tw_timer_t deadline_g;
+static double ramp_credit_g = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void sample_add(samples_t *s, uint64_t ns)
+{
+    if (s->len == s->cap)
+    {
+        size_t cap = s->cap ? s->cap * 2 : 4096;
+        uint32_t *v = realloc(s->v, cap * sizeof(uint32_t));
+        if (!v)
+            return;
+        s->v = v;
+        s->cap = cap;
+    }
+    uint64_t us = ns / 1000;
+    s->v[s->len++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile_ms(const samples_t *s, double p)
+{
+    if (s->len == 0)
+        return 0;
+    size_t i = (size_t)(p * (double)(s->len - 1) + 0.5);
+    return s->v[i] / 1000.0;
+}
+
+static void print_latency(const char *what, samples_t *s)
+{
+    qsort(s->v, s->len, sizeof(uint32_t), cmp_u32);
+    printf("%-22s %8zu samples   p50 %8.2f ms   p99 %8.2f ms   p999 %8.2f ms   max %8.2f ms\n",
+           what, s->len, percentile_ms(s, 0.5), percentile_ms(s, 0.99), percentile_ms(s, 0.999),
+           s->len ? s->v[s->len - 1] / 1000.0 : 0.0);
+}
+
+static void finish_if_done(void)
+{
+    if (stats_g.completed + stats_g.failed == opt_g.clients)
+        reactor_stop(&reactor_g);
+}
+
+static void bot_end(bot_t *bot, bot_state_t state)
+{
+    if (bot->state == BOT_DONE || bot->state == BOT_FAILED)
+        return;
+    timer_cancel(&bot->type_timer);
+    reactor_release(&reactor_g, &bot->handler);
+    close(bot->handler.fd);
+    bot->handler.fd = -1;
+    bot->state = state;
+    if (state == BOT_DONE)
+        stats_g.completed++;
+    else
+        stats_g.failed++;
+    finish_if_done();
+}
+
+static int bot_flush(bot_t *bot)
+{
+    while (bot->out_len > 0)
+    {
+        ssize_t n = send(bot->handler.fd, bot->out, bot->out_len, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        memmove(bot->out, bot->out + n, bot->out_len - (size_t)n);
+        bot->out_len -= (size_t)n;
+    }
+    return 0;
+}
+
+// messages are small and few: they are appended to the pending bytes,
+// which only grow when the server stops reading
+static void bot_send(bot_t *bot, const void *data, size_t len)
+{
+    if (bot->out_len + len > sizeof(bot->out))
+    {
+        bot_end(bot, BOT_FAILED);
+        return;
+    }
+    memcpy(bot->out + bot->out_len, data, len);
+    bot->out_len += len;
+    stats_g.msgs_out++;
+    if (bot_flush(bot) < 0)
+        bot_end(bot, BOT_FAILED);
+}
+
+static size_t put_varint(unsigned char *p, uint64_t v)
+{
+    size_t n = 0;
+    do
+    {
+        p[n] = (unsigned char)(v & 0x7f);
+        v >>= 7;
+        if (v)
+            p[n] |= 0x80;
+        n++;
+    } while (v);
+    return n;
+}
+
+static void on_type_tick(tw_timer_t *timer, void *arg)
+{
+    bot_t *bot = (bot_t *)arg;
+    int i = bot->next_word;
+    const char *word = bot->words + bot->word_off[i];
+    size_t len = (size_t)(bot->word_off[i + 1] - bot->word_off[i]);
+
+    bot->sent_ns[i] = now_ns();
+    bot->next_word++;
+    if (opt_g.binary)
+    {
+        // the payload first, then its length goes in front of it
+        unsigned char frame[BOT_OUT_MAX];
+        unsigned char *body = frame + 3;
+        size_t n = 0;
+        body[n++] = WOP_WORD;
+        n += put_varint(body + n, (uint64_t)i);
+        n += put_varint(body + n, len);
+        memcpy(body + n, word, len);
+        n += len;
+
+        unsigned char hdr[3];
+        size_t h = put_varint(hdr, n);
+        memcpy(body - h, hdr, h);
+        bot_send(bot, body - h, h + n);
+    }
+    else
+    {
+        // the words are echoed as the server sent them, escaped again
+        evbuf_t *b = evbuf_get();
+        event_begin(b, NULL, NULL, NULL);
+        ev_strn(b, "word", word, len);
+        event_end(b);
+        if (!b->oom)
+            bot_send(bot, b->data, b->len);
+    }
+
+    if (bot->state == BOT_PLAYING && bot->next_word < bot->nwords)
+        timer_add(&reactor_g.timers, timer, (uint64_t)(60000 / opt_g.wpm));
+}
+
+static void on_words(bot_t *bot)
+{
+    if (bot->nwords == 0)
+        return;
+    bot->state = BOT_PLAYING;
+    bot->next_word = 0;
+    bot->acked = 0;
+    timer_add(&reactor_g.timers, &bot->type_timer, (uint64_t)(60000 / opt_g.wpm));
+}
+
+static void add_word(bot_t *bot, const char *word, size_t len)
+{
+    int off = bot->word_off[bot->nwords];
+    if (bot->nwords == BOT_WORDS_MAX || off + (int)len > (int)sizeof(bot->words))
+        return;
+    memcpy(bot->words + off, word, len);
+    bot->nwords++;
+    bot->word_off[bot->nwords] = off + (int)len;
+}
+
+// every word up to the count in the scoreboard has reached the lobby
+static void on_own_words(bot_t *bot, int words)
+{
+    uint64_t now = now_ns();
+    if (words > bot->next_word)
+        words = bot->next_word;
+    for (; bot->acked < words; bot->acked++)
+        sample_add(&stats_g.word_lat, now - bot->sent_ns[bot->acked]);
+    if (bot->completed && bot->acked == bot->nwords)
+        bot_end(bot, BOT_DONE);
+}
+
+static void on_lobby(bot_t *bot)
+{
+    if (bot->state != BOT_HANDSHAKE)
+        return;
+    uint64_t now = now_ns();
+    bot->state = BOT_LOBBY;
+    stats_g.established++;
+    if (!stats_g.first_lobby_ns)
+        stats_g.first_lobby_ns = now;
+    stats_g.last_lobby_ns = now;
+    sample_add(&stats_g.connect_lat, now - bot->connect_ns);
+}
+
+static void handle_json(bot_t *bot, const char *text)
+{
+    cJSON *msg = cJSON_Parse(text);
+    if (!msg)
+        return;
+
+    cJSON *type = cJSON_GetObjectItemCaseSensitive(msg, "type");
+    cJSON *data = cJSON_GetObjectItemCaseSensitive(msg, "data");
+    const char *t = cJSON_IsString(type) ? type->valuestring : "";
+
+    if (strcmp(t, "lobby") == 0)
+        on_lobby(bot);
+    else if (strcmp(t, "words") == 0 && bot->state == BOT_LOBBY)
+    {
+        cJSON *word;
+        cJSON_ArrayForEach(word, cJSON_GetObjectItemCaseSensitive(data, "words"))
+            if (cJSON_IsString(word))
+                add_word(bot, word->valuestring, strlen(word->valuestring));
+        on_words(bot);
+    }
+    else if (strcmp(t, "scoreboard") == 0)
+    {
+        cJSON *p;
+        cJSON_ArrayForEach(p, cJSON_GetObjectItemCaseSensitive(data, "players"))
+        {
+            cJSON *uuid = cJSON_GetObjectItemCaseSensitive(p, "uuid");
+            cJSON *words = cJSON_GetObjectItemCaseSensitive(p, "words");
+            if (cJSON_IsString(uuid) && cJSON_IsNumber(words) &&
+                strcmp(uuid->valuestring, bot->uuid_str) == 0)
+                on_own_words(bot, words->valueint);
+        }
+    }
+    else if (strcmp(t, "completed") == 0)
+    {
+        // the scoreboard with the last word comes at the next tick
+        bot->completed = 1;
+        if (bot->acked == bot->nwords)
+            bot_end(bot, BOT_DONE);
+    }
+    else if (strcmp(t, "error") == 0 || strcmp(t, "session_end") == 0 ||
+             strcmp(t, "inactive_timeout") == 0)
+        bot_end(bot, BOT_FAILED);
+    cJSON_Delete(msg);
+}
+
+static void handle_frame(bot_t *bot, const unsigned char *frame, size_t len)
+{
+    const unsigned char *p = frame + 1, *end = frame + len;
+    uint64_t count, v;
+
+    switch (frame[0])
+    {
+    case WOP_WORDS:
+        if (bot->state != BOT_LOBBY || !wire_get_varint(&p, end, &count))
+            return;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            const char *word;
+            size_t word_len;
+            if (!wire_get_str(&p, end, &word, &word_len))
+                break;
+            add_word(bot, word, word_len);
+        }
+        on_words(bot);
+        return;
+    case WOP_SCOREBOARD:
+        if (!wire_get_varint(&p, end, &count))
+            return;
+        for (uint64_t i = 0; i < count && end - p >= 17; i++)
+        {
+            int own = memcmp(p, bot->uuid, 16) == 0;
+            unsigned mask = p[16];
+            p += 17;
+            for (int f = 0; f < BOARD_FIELDS; f++)
+            {
+                if (!(mask & (1u << f)))
+                    continue;
+                if (!wire_get_varint(&p, end, &v))
+                    return;
+                if (own && (1u << f) == BOARD_WORDS)
+                    on_own_words(bot, (int)v);
+            }
+        }
+        return;
+    case WOP_JSON:
+    {
+        char text[LINEBUF_SIZE + 1];
+        memcpy(text, p, (size_t)(end - p));
+        text[end - p] = '\0';
+        handle_json(bot, text);
+        return;
+    }
+    default:
+        return;
+    }
+}
+
+// the handshake reply is already in the protocol asked for
+static void handle_input(bot_t *bot, char *scratch)
+{
+    while (bot->state != BOT_DONE && bot->state != BOT_FAILED)
+    {
+        if (opt_g.binary)
+        {
+            unsigned char *frame;
+            size_t len;
+            int r = linebuf_next_frame(&bot->inbuf, &frame, &len, scratch);
+            if (r <= 0)
+            {
+                if (r < 0)
+                    bot_end(bot, BOT_FAILED);
+                return;
+            }
+            stats_g.msgs_in++;
+            handle_frame(bot, frame, len);
+            continue;
+        }
+
+        char *line;
+        if (!linebuf_next(&bot->inbuf, &line, scratch))
+            return;
+        stats_g.msgs_in++;
+        handle_json(bot, line);
+    }
+}
+
+static void send_handshake(bot_t *bot)
+{
+    char line[BOT_OUT_MAX];
+    int n = snprintf(line, sizeof(line), "{\"uuid\":\"%s\",\"name\":\"bot%d\"%s}\n",
+                     bot->uuid_str, bot->id, opt_g.binary ? ",\"proto\":\"bin\"" : "");
+    bot->state = BOT_HANDSHAKE;
+    bot_send(bot, line, (size_t)n);
+}
+
+static void on_bot_event(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    (void)reactor;
+    bot_t *bot = (bot_t *)handler;
+    char scratch[LINEBUF_SIZE];
+
+    if (bot->state == BOT_CONNECTING)
+    {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if ((events & EPOLLERR) || getsockopt(handler->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+        {
+            bot_end(bot, BOT_FAILED);
+            return;
+        }
+        send_handshake(bot);
+    }
+    else if ((events & EPOLLOUT) && bot_flush(bot) < 0)
+    {
+        bot_end(bot, BOT_FAILED);
+        return;
+    }
+
+    while (bot->state != BOT_DONE && bot->state != BOT_FAILED)
+    {
+        ssize_t r = linebuf_recv(&bot->inbuf, handler->fd);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        if (r <= 0)
+        {
+            bot_end(bot, BOT_FAILED);
+            return;
+        }
+        stats_g.bytes_in += r;
+        handle_input(bot, scratch);
+    }
+}
+
+static void open_bot(bot_t *bot)
+{
+    memset(bot, 0, sizeof(*bot));
+    bot->id = stats_g.opened++;
+    uuid_generate_random(bot->uuid);
+    uuid_unparse_lower(bot->uuid, bot->uuid_str);
+    linebuf_init(&bot->inbuf);
+    timer_init(&bot->type_timer, on_type_tick, bot);
+    bot->handler.on_event = on_bot_event;
+    bot->state = BOT_CONNECTING;
+    bot->connect_ns = now_ns();
+
+    int fd = socket(addr_g.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    bot->handler.fd = fd;
+    if (fd < 0)
+    {
+        bot->state = BOT_FAILED;
+        stats_g.failed++;
+        return;
+    }
+    if ((connect(fd, (struct sockaddr *)&addr_g, addr_len_g) < 0 && errno != EINPROGRESS) ||
+        reactor_add(&reactor_g, &bot->handler, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) < 0)
+    {
+        close(fd);
+        bot->handler.fd = -1;
+        bot->state = BOT_FAILED;
+        stats_g.failed++;
+    }
+}
+
+// the connections are opened a few at every tick to follow the rate,
+// or all in the first tick without a rate
+static void on_ramp_tick(tw_timer_t *timer, void *arg)
+{
+    (void)arg;
+    int n = opt_g.clients - stats_g.opened;
+    if (opt_g.rate > 0)
+    {
+        ramp_credit_g += opt_g.rate * (RAMP_TICK_MS / 1000.0);
+        if ((int)ramp_credit_g < n)
+            n = (int)ramp_credit_g;
+        ramp_credit_g -= n;
+    }
+    for (int i = 0; i < n; i++)
+        open_bot(&bots_g[stats_g.opened]);
+
+    finish_if_done();
+    if (stats_g.opened < opt_g.clients)
+        timer_add(&reactor_g.timers, timer, RAMP_TICK_MS);
+}
+
+static void on_deadline(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    (void)arg;
+    printf("timeout after %ds, stopping\n", opt_g.timeout_sec);
+    reactor_stop(&reactor_g);
+}
+
+// utime + stime of a process, in clock ticks, -1 if not readable
+static long proc_cpu_ticks(int pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char buf[1024];
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // the command name may contain spaces, the fields start after it
+    char *p = strrchr(buf, ')');
+    unsigned long utime, stime;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+        return -1;
+    return (long)(utime + stime);
+}
+
+static int resolve(const char *host, int port)
+{
+    struct addrinfo hints, *res;
+    char service[16];
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(service, sizeof(service), "%d", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0)
+        return -1;
+    memcpy(&addr_g, res->ai_addr, res->ai_addrlen);
+    addr_len_g = res->ai_addrlen;
+    freeaddrinfo(res);
+    return 0;
+}
+
+static void raise_fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-H host] [-p port] [-n clients] [-w wpm] [-r rate] [-b] [-t sec] [-P pid]\n"
+            "  -H  server address (default %s)\n"
+            "  -p  server port (default %d)\n"
+            "  -n  simulated players (default %d)\n"
+            "  -w  typing speed of every player, in words per minute (default %d)\n"
+            "  -r  new connections per second (default: all at once)\n"
+            "  -b  use the binary protocol\n"
+            "  -t  give up after this many seconds (default %d)\n"
+            "  -P  pid of the server, to report its CPU usage\n",
+            prog, opt_g.host, opt_g.port, opt_g.clients, opt_g.wpm, opt_g.timeout_sec);
+}
+
+static int parse_positive(const char *prog, const char *arg)
+{
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (v <= 0 || v > INT_MAX || *end != '\0')
+    {
+        usage(prog);
+        exit(EXIT_FAILURE);
+    }
+    return (int)v;
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "H:p:n:w:r:bt:P:h")) != -1)
+    {
+        switch (c)
+        {
+        case 'H':
+            opt_g.host = optarg;
+            break;
+        case 'p':
+            opt_g.port = parse_positive(argv[0], optarg);
+            break;
+        case 'n':
+            opt_g.clients = parse_positive(argv[0], optarg);
+            break;
+        case 'w':
+            opt_g.wpm = parse_positive(argv[0], optarg);
+            break;
+        case 'r':
+            opt_g.rate = parse_positive(argv[0], optarg);
+            break;
+        case 'b':
+            opt_g.binary = 1;
+            break;
+        case 't':
+            opt_g.timeout_sec = parse_positive(argv[0], optarg);
+            break;
+        case 'P':
+            opt_g.server_pid = parse_positive(argv[0], optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    if (opt_g.wpm > 60000)
+        opt_g.wpm = 60000;
+
+    if (resolve(opt_g.host, opt_g.port) < 0)
+    {
+        fprintf(stderr, "***ERROR: can't resolve %s\n", opt_g.host);
+        exit(EXIT_FAILURE);
+    }
+    raise_fd_limit();
+
+    bots_g = calloc((size_t)opt_g.clients, sizeof(bot_t));
+    if (!bots_g || reactor_init(&reactor_g) < 0)
+    {
+        perror("***ERROR: setup failed");
+        exit(EXIT_FAILURE);
+    }
+
+    long server_ticks = opt_g.server_pid ? proc_cpu_ticks(opt_g.server_pid) : -1;
+    struct rusage ru_start, ru_end;
+    getrusage(RUSAGE_SELF, &ru_start);
+    stats_g.start_ns = now_ns();
+
+    timer_init(&ramp_timer_g, on_ramp_tick, NULL);
+    timer_add(&reactor_g.timers, &ramp_timer_g, 0);
+    timer_init(&deadline_g, on_deadline, NULL);
+    timer_add(&reactor_g.timers, &deadline_g, (uint64_t)opt_g.timeout_sec * 1000);
+
+    printf("%d players, %d wpm, %s protocol, against %s:%d\n", opt_g.clients, opt_g.wpm,
+           opt_g.binary ? "binary" : "json", opt_g.host, opt_g.port);
+    reactor_run(&reactor_g);
+
+    double elapsed = (now_ns() - stats_g.start_ns) / 1e9;
+    getrusage(RUSAGE_SELF, &ru_end);
+
+    printf("players                %8d opened   %8d in a lobby   %8d completed   %8d failed\n",
+           stats_g.opened, stats_g.established, stats_g.completed, stats_g.failed);
+    double ramp = (stats_g.last_lobby_ns - stats_g.start_ns) / 1e9;
+    printf("connection rate        %8.1f /s (handshake done, over %.2f s)\n",
+           ramp > 0 ? stats_g.established / ramp : 0.0, ramp);
+    print_latency("connect -> lobby", &stats_g.connect_lat);
+    print_latency("word -> scoreboard", &stats_g.word_lat);
+    printf("messages               %8.1f /s in   %8.1f /s out   %8.1f KiB/s in, over %.2f s\n",
+           stats_g.msgs_in / elapsed, stats_g.msgs_out / elapsed, stats_g.bytes_in / 1024.0 / elapsed, elapsed);
+
+    long hz = sysconf(_SC_CLK_TCK);
+    if (server_ticks >= 0 && hz > 0)
+    {
+        long end_ticks = proc_cpu_ticks(opt_g.server_pid);
+        if (end_ticks >= 0)
+            printf("server cpu             %8.1f %%\n", 100.0 * (end_ticks - server_ticks) / hz / elapsed);
+    }
+    double self_cpu = (ru_end.ru_utime.tv_sec - ru_start.ru_utime.tv_sec) +
+                      (ru_end.ru_utime.tv_usec - ru_start.ru_utime.tv_usec) / 1e6 +
+                      (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) +
+                      (ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+    printf("loadgen cpu            %8.1f %%\n", 100.0 * self_cpu / elapsed);
+
+    for (int i = 0; i < stats_g.opened; i++)
+        if (bots_g[i].handler.fd >= 0 && bots_g[i].state != BOT_DONE && bots_g[i].state != BOT_FAILED)
+            close(bots_g[i].handler.fd);
+    reactor_destroy(&reactor_g);
+    free(bots_g);
+    free(stats_g.connect_lat.v);
+    free(stats_g.word_lat.v);
+    return stats_g.failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include "lockprof.h"
+
+// only built with make LOCKPROF=1, see lockprof.h
+
+#define HELD_MAX 8 // mutexes held at the same time by a thread
+
+static const char *class_names[LOCK_CLASSES] = {
+    [LOCK_UUIDMAP] = "uuidmap",
+    [LOCK_SESSION_GROW] = "session_grow",
+    [LOCK_RESULTS] = "results",
+};
+
+static lock_site_t *_Atomic sites_g = NULL; // every site taken at least once
+
+// what a thread holds, to charge the hold time to the site that took it
+typedef struct held_s
+{
+    pthread_mutex_t *m;
+    lock_site_t *site;
+    uint64_t since;
+} held_t;
+
+static _Thread_local held_t held_tls[HELD_MAX];
+static _Thread_local int nheld_tls = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void store_max(_Atomic uint64_t *max, uint64_t v)
+{
+    uint64_t cur = atomic_load_explicit(max, memory_order_relaxed);
+    while (v > cur && !atomic_compare_exchange_weak_explicit(max, &cur, v, memory_order_relaxed,
+                                                             memory_order_relaxed))
+        ;
+}
+
+static void site_register(lock_site_t *site)
+{
+    if (atomic_exchange(&site->registered, 1))
+        return;
+    lock_site_t *head = atomic_load(&sites_g);
+    do
+        site->next = head;
+    while (!atomic_compare_exchange_weak(&sites_g, &head, site));
+}
+
+// a free mutex is taken with trylock, so the uncontended case
+// doesn't read the clock twice
+void lockprof_take(pthread_mutex_t *m, lock_site_t *site)
+{
+    site_register(site);
+
+    if (pthread_mutex_trylock(m) == EBUSY)
+    {
+        uint64_t start = now_ns();
+        pthread_mutex_lock(m);
+        uint64_t waited = now_ns() - start;
+        atomic_fetch_add_explicit(&site->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&site->wait_ns, waited, memory_order_relaxed);
+        store_max(&site->wait_max, waited);
+    }
+    atomic_fetch_add_explicit(&site->acquired, 1, memory_order_relaxed);
+
+    if (nheld_tls < HELD_MAX)
+        held_tls[nheld_tls++] = (held_t){m, site, now_ns()};
+}
+
+void lockprof_drop(pthread_mutex_t *m)
+{
+    for (int i = nheld_tls - 1; i >= 0; i--)
+    {
+        if (held_tls[i].m != m)
+            continue;
+
+        lock_site_t *site = held_tls[i].site;
+        uint64_t held = now_ns() - held_tls[i].since;
+        atomic_fetch_add_explicit(&site->hold_ns, held, memory_order_relaxed);
+        store_max(&site->hold_max, held);
+        for (int j = i; j < nheld_tls - 1; j++)
+            held_tls[j] = held_tls[j + 1];
+        nheld_tls--;
+        break;
+    }
+    pthread_mutex_unlock(m);
+}
+
+typedef struct lock_totals_s
+{
+    uint64_t acquired, contended, wait_ns, wait_max, hold_ns, hold_max;
+} lock_totals_t;
+
+static void site_totals(const lock_site_t *s, lock_totals_t *t)
+{
+    t->acquired = atomic_load_explicit(&s->acquired, memory_order_relaxed);
+    t->contended = atomic_load_explicit(&s->contended, memory_order_relaxed);
+    t->wait_ns = atomic_load_explicit(&s->wait_ns, memory_order_relaxed);
+    t->wait_max = atomic_load_explicit(&s->wait_max, memory_order_relaxed);
+    t->hold_ns = atomic_load_explicit(&s->hold_ns, memory_order_relaxed);
+    t->hold_max = atomic_load_explicit(&s->hold_max, memory_order_relaxed);
+}
+
+static void put_row(evbuf_t *b, const char *name, const lock_totals_t *t)
+{
+    double pct = t->acquired ? 100.0 * (double)t->contended / (double)t->acquired : 0;
+    ev_printf(b, "%-22s %12llu %12llu %6.2f%% %12.1f %10.1f %12.1f %10.1f\n", name,
+              (unsigned long long)t->acquired, (unsigned long long)t->contended, pct, t->wait_ns / 1e3,
+              t->wait_max / 1e3, t->hold_ns / 1e3, t->hold_max / 1e3);
+}
+
+void lockprof_report(evbuf_t *b)
+{
+    ev_printf(b, "%-22s %12s %12s %7s %12s %10s %12s %10s   (us)\n", "lock", "acquired", "contended", "",
+              "wait", "wait max", "held", "held max");
+
+    for (int c = 0; c < LOCK_CLASSES; c++)
+    {
+        lock_totals_t sum = {0};
+        for (lock_site_t *s = atomic_load(&sites_g); s; s = s->next)
+        {
+            if (s->cls != (lock_class_t)c)
+                continue;
+            lock_totals_t t;
+            site_totals(s, &t);
+            sum.acquired += t.acquired;
+            sum.contended += t.contended;
+            sum.wait_ns += t.wait_ns;
+            sum.hold_ns += t.hold_ns;
+            if (t.wait_max > sum.wait_max)
+                sum.wait_max = t.wait_max;
+            if (t.hold_max > sum.hold_max)
+                sum.hold_max = t.hold_max;
+        }
+        put_row(b, class_names[c], &sum);
+
+        for (lock_site_t *s = atomic_load(&sites_g); s; s = s->next)
+        {
+            if (s->cls != (lock_class_t)c)
+                continue;
+            char name[64];
+            snprintf(name, sizeof(name), "  %s:%d", s->file, s->line);
+            lock_totals_t t;
+            site_totals(s, &t);
+            put_row(b, name, &t);
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "event.h"
+
+// mutex profiling, built in with make LOCKPROF=1. The server takes and
+// releases its mutexes through lock_take and lock_drop which, in that
+// build, record for every call site the acquisitions, the ones that
+// found the mutex taken, the time spent waiting for it and the time it
+// was held. Otherwise they are the bare pthread calls
+typedef enum lock_class_e
+{
+    LOCK_UUIDMAP,      // stripes of the players index
+    LOCK_SESSION_GROW, // adding a chunk to the session list
+    LOCK_RESULTS,      // results index, writer vs queries
+    LOCK_CLASSES
+} lock_class_t;
+
+#ifdef LOCK_PROFILE
+
+typedef struct lock_site_s
+{
+    const char *file;
+    int line;
+    lock_class_t cls;
+    atomic_int registered;
+    struct lock_site_s *next;
+    // shared by the threads going through the site: the profiling
+    // build pays an atomic add per counter
+    _Atomic uint64_t acquired;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t wait_ns;
+    _Atomic uint64_t wait_max;
+    _Atomic uint64_t hold_ns;
+    _Atomic uint64_t hold_max;
+} lock_site_t;
+
+void lockprof_take(pthread_mutex_t *m, lock_site_t *site);
+void lockprof_drop(pthread_mutex_t *m);
+
+#define lock_take(m, c)                                                                  \
+    do                                                                                   \
+    {                                                                                    \
+        static lock_site_t lock_site_ = {.file = __FILE__, .line = __LINE__, .cls = c}; \
+        lockprof_take(m, &lock_site_);                                                   \
+    } while (0)
+#define lock_drop(m) lockprof_drop(m)
+
+// per class, then per call site, since the start
+void lockprof_report(evbuf_t *b);
+
+#else
+
+#define lock_take(m, c) pthread_mutex_lock(m)
+#define lock_drop(m)    pthread_mutex_unlock(m)
+
+static inline void lockprof_report(evbuf_t *b)
+{
+    (void)b;
+}
+
+#endif
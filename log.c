@@ -0,0 +1,368 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include "log.h"
+#include "stats.h"
+#include "mpscq.h"
+
+#define LOG_OUT_SIZE (64 * 1024)
+#define LOG_LINE_MAX     (160 + 4 * LOG_MSG_MAX) // a message byte takes 4 at most
+
+log_level_t log_level_g = LOG_INFO;
+
+static _Thread_local log_ring_t *log_tls = NULL;
+static log_ring_t *_Atomic rings_g[LOG_RINGS_MAX];
+static atomic_int nrings_g = 0;
+
+// given to the threads that couldn't get a ring: it always looks
+// full, so their records are dropped and counted
+static log_ring_t full_g = {.id = -1, .head = LOG_RING_SIZE};
+
+// a text of several lines, written as it is between the records
+typedef struct log_block_s
+{
+    mpsc_node_t node;
+    size_t len;
+    char data[];
+} log_block_t;
+
+static mpscq_t blocks_g;
+
+static int out_fd_g = -1;
+static int wake_fd_g = -1;        // the writer sleeps on it
+static atomic_int sleeping_g = 0; // the writer is about to sleep, or sleeping
+static atomic_int running_g = 0;
+static atomic_int done_g = 0;
+static pthread_t writer_g;
+
+static const char *level_names[] = {
+    [LOG_DEBUG] = "debug",
+    [LOG_INFO] = "info",
+    [LOG_WARN] = "warn",
+    [LOG_ERROR] = "error",
+};
+
+// the first producer to find the writer asleep writes the eventfd
+static void wake_writer(void)
+{
+    if (!atomic_exchange(&sleeping_g, 0))
+        return;
+
+    uint64_t one = 1;
+    while (write(wake_fd_g, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+static log_ring_t *log_attach(void)
+{
+    int i = atomic_fetch_add(&nrings_g, 1);
+    log_ring_t *r = i < LOG_RINGS_MAX ? aligned_alloc(_Alignof(log_ring_t), sizeof(log_ring_t)) : NULL;
+    if (r)
+    {
+        r->id = i;
+        atomic_init(&r->head, 0);
+        atomic_init(&r->dropped, 0);
+        atomic_init(&r->tail, 0);
+        atomic_store_explicit(&rings_g[i], r, memory_order_release);
+    }
+    log_tls = r ? r : &full_g;
+    return log_tls;
+}
+
+void log_vwrite(log_level_t level, int session, const unsigned char *uuid, const char *fmt, va_list ap)
+{
+    if (level < log_level_g)
+        return;
+
+    log_ring_t *r = log_tls ? log_tls : log_attach();
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) >= LOG_RING_SIZE)
+    {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        stats_inc(STAT_LOG_DROPPED);
+        return;
+    }
+
+    log_rec_t *rec = &r->recs[head & (LOG_RING_SIZE - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    rec->session = session;
+    rec->level = (uint8_t)level;
+    rec->has_uuid = uuid != NULL;
+    if (uuid)
+        memcpy(rec->uuid, uuid, sizeof(uuid_t));
+    int n = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    rec->len = (uint16_t)(n < 0 ? 0 : n >= LOG_MSG_MAX ? LOG_MSG_MAX - 1 : n);
+
+    // the record is complete before the writer can see it
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+    // only a record landing in an empty ring can find the writer asleep.
+    // The fence pairs with the writer's: either its last look at the
+    // rings sees this record, or this sees it going to sleep
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&r->tail, memory_order_relaxed) == head &&
+        atomic_load_explicit(&sleeping_g, memory_order_relaxed))
+        wake_writer();
+}
+
+void log_write(log_level_t level, int session, const unsigned char *uuid, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, session, uuid, fmt, ap);
+    va_end(ap);
+}
+
+// ------------------------------------------------------------------
+// writer thread: logfmt lines, e.g.
+// ts=2026-01-01T10:00:00.123Z level=info thread=1 session=4 uuid=... msg="..."
+
+typedef struct out_s
+{
+    char data[LOG_OUT_SIZE];
+    size_t len;
+} out_t;
+
+static void out_write(const char *data, size_t len)
+{
+    size_t off = 0;
+    while (off < len)
+    {
+        ssize_t n = write(out_fd_g, data + off, len - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break; // nowhere to write to, the lines are lost
+        off += (size_t)n;
+    }
+}
+
+static void out_flush(out_t *o)
+{
+    out_write(o->data, o->len);
+    o->len = 0;
+}
+
+// a line is at most LOG_LINE_MAX bytes, whatever the message
+static void out_line(out_t *o, uint64_t ts_ns, int level, int thread, int session, const unsigned char *uuid,
+                     const char *msg, size_t len)
+{
+    if (o->len > sizeof(o->data) - LOG_LINE_MAX)
+        out_flush(o);
+
+    char *p = o->data + o->len;
+    char *end = o->data + sizeof(o->data);
+    time_t sec = (time_t)(ts_ns / 1000000000ull);
+    struct tm tm;
+    gmtime_r(&sec, &tm);
+    p += snprintf(p, (size_t)(end - p), "ts=%04d-%02d-%02dT%02d:%02d:%02d.%03dZ level=%s thread=%d",
+                  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                  (int)(ts_ns / 1000000 % 1000), level_names[level], thread);
+    if (session >= 0)
+        p += snprintf(p, (size_t)(end - p), " session=%d", session);
+    if (uuid)
+    {
+        char text[37];
+        uuid_unparse_lower(uuid, text);
+        p += snprintf(p, (size_t)(end - p), " uuid=%s", text);
+    }
+
+    memcpy(p, " msg=\"", 6);
+    p += 6;
+    // control bytes come from names and words the clients chose:
+    // they are written as \xNN, never raw
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)msg[i];
+        if (c == '"' || c == '\\')
+        {
+            *p++ = '\\';
+            *p++ = (char)c;
+        }
+        else if (c == '\n')
+        {
+            *p++ = '\\';
+            *p++ = 'n';
+        }
+        else if (c < 0x20 || c == 0x7f)
+        {
+            *p++ = '\\';
+            *p++ = 'x';
+            *p++ = "0123456789abcdef"[c >> 4];
+            *p++ = "0123456789abcdef"[c & 0xf];
+        }
+        else
+            *p++ = (char)c;
+    }
+    *p++ = '"';
+    *p++ = '\n';
+    o->len = (size_t)(p - o->data);
+}
+
+static size_t drain(out_t *o, uint64_t *reported)
+{
+    size_t total = 0;
+    int n = atomic_load(&nrings_g);
+    if (n > LOG_RINGS_MAX)
+        n = LOG_RINGS_MAX;
+
+    for (int i = 0; i < n; i++)
+    {
+        log_ring_t *r = atomic_load_explicit(&rings_g[i], memory_order_acquire);
+        if (!r)
+            continue;
+
+        uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+        for (; tail != head; tail++)
+        {
+            log_rec_t *rec = &r->recs[tail & (LOG_RING_SIZE - 1)];
+            out_line(o, rec->ts_ns, rec->level, r->id, rec->session, rec->has_uuid ? rec->uuid : NULL,
+                     rec->msg, rec->len);
+            total++;
+        }
+        atomic_store_explicit(&r->tail, tail, memory_order_release);
+
+        uint64_t dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        if (dropped != reported[i])
+        {
+            char msg[64];
+            int len = snprintf(msg, sizeof(msg), "%llu records dropped, the log ring was full",
+                               (unsigned long long)(dropped - reported[i]));
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            out_line(o, (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec, LOG_WARN, r->id, -1, NULL,
+                     msg, (size_t)len);
+            reported[i] = dropped;
+        }
+    }
+
+    // the lines already formatted go out first
+    mpsc_node_t *node;
+    while ((node = mpscq_pop(&blocks_g)))
+    {
+        log_block_t *block = (log_block_t *)((char *)node - offsetof(log_block_t, node));
+        out_flush(o);
+        out_write(block->data, block->len);
+        free(block);
+        total++;
+    }
+    return total;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    static out_t out;
+    static uint64_t reported[LOG_RINGS_MAX];
+
+    for (;;)
+    {
+        int stopping = !atomic_load(&running_g);
+        size_t n = drain(&out, reported);
+        out_flush(&out);
+        if (n > 0)
+        {
+            atomic_store_explicit(&sleeping_g, 0, memory_order_relaxed);
+            continue;
+        }
+        if (stopping)
+            break;
+
+        // the rings are looked at once more after saying so, anything
+        // published later wakes the writer up
+        if (!atomic_load_explicit(&sleeping_g, memory_order_relaxed))
+        {
+            atomic_store_explicit(&sleeping_g, 1, memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+            continue;
+        }
+
+        uint64_t v;
+        while (read(wake_fd_g, &v, sizeof(v)) < 0 && errno == EINTR)
+            ;
+    }
+    atomic_store(&done_g, 1);
+    return NULL;
+}
+
+int log_start(int fd)
+{
+    out_fd_g = fd;
+    mpscq_init(&blocks_g);
+    wake_fd_g = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd_g < 0)
+    {
+        perror("***ERROR: failed to set up the log writer");
+        return -1;
+    }
+    atomic_store(&running_g, 1);
+
+    // the signals are for the workers, the writer never takes them
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int err = pthread_create(&writer_g, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0)
+    {
+        fprintf(stderr, "***ERROR: failed to start the log writer: %s\n", strerror(err));
+        atomic_store(&running_g, 0);
+        close(wake_fd_g);
+        wake_fd_g = -1;
+        return -1;
+    }
+    return 0;
+}
+
+void log_block(const char *data, size_t len)
+{
+    log_block_t *block = atomic_load(&running_g) ? malloc(sizeof(*block) + len) : NULL;
+    if (!block)
+    {
+        stats_inc(STAT_LOG_DROPPED);
+        return;
+    }
+    block->len = len;
+    memcpy(block->data, data, len);
+    mpscq_push(&blocks_g, &block->node);
+
+    // rare enough to check the writer every time
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sleeping_g, memory_order_relaxed))
+        wake_writer();
+}
+
+// a writer stuck on an output nobody reads is left behind,
+// the process is about to exit anyway
+void log_stop(void)
+{
+    if (!atomic_exchange(&running_g, 0))
+        return;
+
+    // woken up whether it sleeps or not, it drains what is left and exits
+    uint64_t one = 1;
+    while (write(wake_fd_g, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+
+    struct timespec pause = {0, LOG_STOP_POLL_MS * 1000000L};
+    for (int waited = 0; !atomic_load(&done_g); waited += LOG_STOP_POLL_MS)
+    {
+        if (waited >= LOG_STOP_MS)
+            return;
+        nanosleep(&pause, NULL);
+    }
+    pthread_join(writer_g, NULL);
+    close(wake_fd_g);
+    wake_fd_g = -1;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <uuid/uuid.h>
+
+// asynchronous logging. A thread writes its records into a ring of its
+// own, with no lock and no system call: a background thread drains the
+// rings and writes the lines, so a slow stdout only delays the log. A
+// record that doesn't fit in a full ring is dropped and counted. The
+// writer sleeps when every ring is empty, the record that finds its
+// ring empty wakes it up. Records have a fixed size, the message is cut
+// to LOG_MSG_MAX - 1
+#define LOG_RING_SIZE  1024 // records per thread, a power of two
+#define LOG_RINGS_MAX  128
+#define LOG_MSG_MAX    96
+#define LOG_STOP_MS    2000 // how long stopping waits for the writer
+#define LOG_STOP_POLL_MS 10
+
+typedef enum log_level_e
+{
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} log_level_t;
+
+typedef struct log_rec_s
+{
+    uint64_t ts_ns;  // CLOCK_REALTIME
+    int32_t session; // slot of the lobby, -1 for none
+    uint8_t level;
+    uint8_t has_uuid;
+    uint16_t len;
+    uuid_t uuid;
+    char msg[LOG_MSG_MAX];
+} log_rec_t;
+
+// single producer (the owner thread), single consumer (the writer)
+typedef struct log_ring_s
+{
+    int id;
+    _Alignas(64) _Atomic uint64_t head; // next record to write
+    _Atomic uint64_t dropped;
+    _Alignas(64) _Atomic uint64_t tail; // next record to drain
+    log_rec_t recs[LOG_RING_SIZE];
+} log_ring_t;
+
+extern log_level_t log_level_g;
+
+// the writer thread, started before the first record and stopped
+// after the last one: stopping drains what is left
+int log_start(int fd);
+void log_stop(void);
+
+// uuid may be NULL
+void log_write(log_level_t level, int session, const unsigned char *uuid, const char *fmt, ...)
+    __attribute__((format(printf, 4, 5)));
+void log_vwrite(log_level_t level, int session, const unsigned char *uuid, const char *fmt, va_list ap);
+// a text of any length (a report, a table) written as it is, between
+// two records: it is copied, and dropped when the writer isn't running
+void log_block(const char *data, size_t len);
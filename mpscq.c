@@ -0,0 +1,51 @@
+#include <stddef.h>
+#include "mpscq.h"
+
+void mpscq_init(mpscq_t *q)
+{
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+// the node is visible to the consumer only once linked to the previous
+// head: between the exchange and the link the queue looks cut short
+void mpscq_push(mpscq_t *q, mpsc_node_t *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    mpsc_node_t *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+mpsc_node_t *mpscq_pop(mpscq_t *q)
+{
+    mpsc_node_t *tail = q->tail;
+    mpsc_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub)
+    {
+        if (!next)
+            return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next)
+    {
+        q->tail = next;
+        return tail;
+    }
+
+    // the tail is the last node: the stub is pushed behind it so that
+    // it can be taken out without leaving the queue empty of nodes
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire))
+        return NULL;
+    mpscq_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next)
+    {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
@@ -0,0 +1,27 @@
+#pragma once
+#include <stdatomic.h>
+
+// intrusive multi-producer single-consumer queue (Vyukov). Any thread
+// can push with a single atomic exchange, only the owner of the queue
+// pops. The nodes are embedded in the objects being passed around, so
+// nothing is allocated
+typedef struct mpsc_node_s
+{
+    struct mpsc_node_s *_Atomic next;
+} mpsc_node_t;
+
+// the producers' end and the consumer's one sit on different cache
+// lines, so pushing doesn't keep stealing the line the consumer reads
+typedef struct mpscq_s
+{
+    _Alignas(64) mpsc_node_t *_Atomic head; // last pushed
+    _Alignas(64) mpsc_node_t *tail;         // next to pop
+    mpsc_node_t stub;
+} mpscq_t;
+
+void mpscq_init(mpscq_t *q);
+void mpscq_push(mpscq_t *q, mpsc_node_t *node);
+
+// returns NULL when the queue is empty, or when a producer is halfway
+// through a push: that producer will notify the consumer again
+mpsc_node_t *mpscq_pop(mpscq_t *q);
@@ -1,207 +1,815 @@
 #define _POSIX_C_SOURCE 200809L
 #include <time.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <pthread.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <fcntl.h>
 #include <cjson/cJSON.h>
 #include <errno.h>
+#include <limits.h>
 #include "network.h"
 #include "backend.h"
+#include "event.h"
+#include "outq.h"
+#include "pool.h"
+#include "wire.h"
+#include "shard.h"
+#include "stats.h"
+#include "latency.h"
+#include "lockprof.h"
+#include "log.h"
+#include "results.h"
 
-pthread_mutex_t client_lock_g = PTHREAD_MUTEX_INITIALIZER;
 session_list_t *list_g;
-int active_clients_g = 0;
+atomic_int active_clients_g = 0;
+int max_clients_g = 0; // set at startup from -c or the open files limit
+
+// a worker is a shard with the clients it runs, and its own listener
+// when the kernel can spread the connections (SO_REUSEPORT). Clients
+// may be released by another worker than the one that carved them,
+// which is fine since the slabs are only freed at exit
+typedef struct worker_s
+{
+    shard_t shard;
+    reactor_handler_t listener;
+    tw_timer_t accept_retry;
+    uint64_t accept_logged_ms; // last accept error logged
+    pool_t client_pool; // client_t storage, recycled between connections
+    client_t *clients;  // every live connection of the worker
+} worker_t;
+
+static worker_t *workers_g;
+static int nworkers_g = 0;
+static shard_t admin_g; // the admin endpoint, off the game threads
+static int admin_port_g = ADMIN_PORT;
+static const char *results_prefix_g = RESULTS_DEFAULT_PREFIX;
+static int board_interval_ms_g = 1000 / SCOREBOARD_DEFAULT_HZ;
+static uuidmap_t players_g; // every client past the handshake, by uuid
+
+#define CLIENT_EVENTS (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET)
 
 static inline double timespec_diff_sec(const struct timespec *a, const struct timespec *b)
 {
     return (a->tv_sec - b->tv_sec) + (a->tv_nsec - b->tv_nsec) / 1e9;
 }
 
-static void send_json_line(int fd, cJSON *root)
+static inline worker_t *worker_of(shard_t *shard)
+{
+    return (worker_t *)shard;
+}
+
+static inline timer_wheel_t *client_timers(client_t *client)
+{
+    return &client->shard->reactor.timers;
+}
+
+static inline timer_wheel_t *session_timers(const session_t *session)
+{
+    return &workers_g[session->shard].shard.reactor.timers;
+}
+
+// the records of a client carry its lobby and its uuid, once it has them
+static void log_client(log_level_t level, const client_t *client, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static void log_client(log_level_t level, const client_t *client, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    log_vwrite(level, client->session ? client->session->slot : -1, client->uuid[0] ? client->uuid_key.key : NULL,
+               fmt, ap);
+    va_end(ap);
+}
+
+static void on_send_failed(client_t *client, int ret)
 {
-    char *s = cJSON_PrintUnformatted(root);
-    if (!s)
+    if (ret == OUTQ_OVERFLOW)
     {
-        cJSON_Delete(root);
-        return;
+        log_client(LOG_WARN, client, "Disconnecting slow client: output queue over %zu bytes (%lu events dropped)",
+                   outq_limits_g.max_bytes, client->outq.dropped_msgs);
+        stats_inc(STAT_KICK_SLOW);
     }
-#ifdef MSG_NOSIGNAL
-    send(fd, s, strlen(s), MSG_NOSIGNAL);
-    send(fd, "\n", 1, MSG_NOSIGNAL);
-#else
-    send(fd, s, strlen(s), 0);
-    send(fd, "\n", 1, 0);
-#endif
-    free(s);
-    cJSON_Delete(root);
+    else
+        client->lost = 1;
+
+    // closing right away could free the session the caller is still
+    // working on, so the client is closed by the next timer wheel run
+    if (client->state != CLIENT_CLOSED && !timer_pending(&client->close_timer))
+        timer_add(client_timers(client), &client->close_timer, 0);
 }
 
-static void send_event(int fd,
-                       const char *type,
-                       const char *player,
-                       const char *message,
-                       cJSON *data)
+// the data is already encoded for the protocol of the client, and goes
+// through its output queue to keep the order of the events
+static void send_encoded(client_t *client, const evbuf_t *b)
 {
-    cJSON *root = cJSON_CreateObject();
-    if (!root)
-    {
-        if (data)
-            cJSON_Delete(data);
+    if (b->oom || client->state == CLIENT_PARKED)
         return;
-    }
 
-    if (type)
-        cJSON_AddStringToObject(root, "type", type);
-    if (player)
-        cJSON_AddStringToObject(root, "player", player);
-    if (message)
-        cJSON_AddStringToObject(root, "message", message);
-    if (data)
-        cJSON_AddItemToObject(root, "data", data);
+    outmsg_t *shared = NULL;
+    int ret = outq_send(&client->outq, client->socket, b->data, b->len, &shared, 0);
+    outmsg_unref(shared);
+    if (ret < 0)
+        on_send_failed(client, ret);
+}
+
+// events are encoded as a full JSON line, newline included: binary
+// clients get it wrapped in a frame
+static void send_line(client_t *client, const evbuf_t *b)
+{
+    send_encoded(client, client->binary ? wire_json(b) : b);
+}
 
-    send_json_line(fd, root);
+static void send_event(client_t *client, const char *type, const char *player, const char *message)
+{
+    send_line(client, event_simple(type, player, message));
 }
 
-static void notify_all_players_event(session_t *session,
-                                     client_t *client,
-                                     const char *type,
-                                     const char *player,
-                                     const char *message,
-                                     cJSON *data)
+// the event is encoded once per protocol by the caller: players whose
+// queue is empty get it written directly from the encoding buffer, the
+// others share a single copy of it in their output queues. Without a
+// binary encoding, binary players get the JSON line wrapped in a frame.
+// Droppable events may be skipped for players that are too far behind,
+// and parked players get nothing until they reconnect
+static void notify_all_players(session_t *session, client_t *client,
+                               const evbuf_t *json, const evbuf_t *bin, int droppable)
 {
-    int fds[MAX_LOBBY_COUNT], n = 0;
+    client_t *players[MAX_LOBBY_COUNT];
+    int n = 0;
+
+    if (json->oom)
+        return;
 
-    pthread_mutex_lock(&session->lock);
     for (int i = 0; i < MAX_LOBBY_COUNT; i++)
-        if (session->players[i] && (client == NULL || session->players[i] != client))
-            fds[n++] = session->players[i]->socket;
-    pthread_mutex_unlock(&session->lock);
+        if (session->players[i] && session->players[i] != client &&
+            session->players[i]->state != CLIENT_PARKED)
+            players[n++] = session->players[i];
 
+    outmsg_t *shared = NULL;
+    outmsg_t *shared_bin = NULL;
+    uint64_t t = lat_now();
     for (int i = 0; i < n; i++)
     {
-        cJSON *copy = data ? cJSON_Duplicate(data, 1) : NULL;
-        send_event(fds[i], type, player, message, copy);
+        const evbuf_t *b = json;
+        outmsg_t **sh = &shared;
+        if (players[i]->binary)
+        {
+            if (!bin)
+                bin = wire_json(json);
+            b = bin;
+            sh = &shared_bin;
+        }
+        if (b->oom)
+            continue;
+
+        int ret = outq_send(&players[i]->outq, players[i]->socket, b->data, b->len, sh, droppable);
+        if (ret < 0)
+            on_send_failed(players[i], ret);
+        lat_lap(LAT_SEND, &t);
     }
-    if (data)
-        cJSON_Delete(data);
+    outmsg_unref(shared);
+    outmsg_unref(shared_bin);
 }
 
-// returns the list of players already in the session
-// in JSON format. The lock is needed since one player
-// could exit the lobby while the count is taking place
-static cJSON *build_players_list_obj(session_t *session, const char *uuid)
+// encodes the "lobby" event with the list of players already in the session
+static evbuf_t *build_lobby_event(session_t *session, const client_t *client)
 {
-    pthread_mutex_lock(&session->lock);
-    cJSON *root = cJSON_CreateObject();
-    cJSON *array = cJSON_CreateArray();
-    if (!array || !root)
-    {
-        return NULL;
-    }
+    evbuf_t *b = evbuf_get();
+    event_begin(b, "lobby", NULL, "added to lobby");
+    ev_obj_open(b, "data");
+    ev_arr_open(b, "players");
 
     for (int i = 0; i < MAX_LOBBY_COUNT; i++)
     {
         // we need to add only players that are not us, since this
         // function will be called right after the we will be added calling
         // the add_player function
-        if (session->players[i] && strcmp(session->players[i]->uuid, uuid) != 0)
+        if (session->players[i] && session->players[i] != client)
         {
-            cJSON *obj = cJSON_CreateObject();
-            if (!obj)
-            {
-                return NULL;
-            }
-
-            cJSON_AddStringToObject(obj, "uuid", session->players[i]->uuid);
-            cJSON_AddStringToObject(obj, "name", session->players[i]->name);
-            cJSON_AddItemToArray(array, obj);
+            ev_obj_open(b, NULL);
+            ev_str(b, "uuid", session->players[i]->uuid);
+            ev_str(b, "name", session->players[i]->name);
+            ev_obj_close(b);
         }
     }
 
-    cJSON_AddItemToObject(root, "players", array);
-    pthread_mutex_unlock(&session->lock);
-    return root;
+    ev_arr_close(b);
+    ev_obj_close(b);
+    event_end(b);
+    return b;
+}
+
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// still handled by this thread: not closed nor leaving for another shard
+static inline int client_here(const client_t *client)
+{
+    return client->state != CLIENT_CLOSED && client->state != CLIENT_MOVING;
+}
+
+static void client_link(client_t *client)
+{
+    worker_t *w = worker_of(client->shard);
+    client->prev = NULL;
+    client->next = w->clients;
+    if (w->clients)
+        w->clients->prev = client;
+    w->clients = client;
+}
+
+static void client_unlink(client_t *client)
+{
+    if (client->prev)
+        client->prev->next = client->next;
+    else
+        worker_of(client->shard)->clients = client->next;
+    if (client->next)
+        client->next->prev = client->prev;
+    client->prev = client->next = NULL;
+}
+
+// removes the client from its lobby and tells the other players
+// that it left, in order to update their UI
+static void leave_session(client_t *client)
+{
+    session_t *session = client->session;
+    if (!session)
+        return;
+
+    client->session = NULL;
+    timer_cancel(&client->idle_timer);
+    timer_cancel(&client->grace_timer);
+
+    // the last one out stops the lobby, which no longer counts as running.
+    // A seat may still be held by a client moving here from another shard,
+    // the lobby then goes on for it. The timers belong to this shard and
+    // are stopped before the seat is given back, since from then on the
+    // slot can be recycled by any thread
+    if (client->seat >= 0 && session->seated == 1 && SEATS_COUNT(atomic_load(&session->seats)) == 1)
+    {
+        if (!session->ended && session->has_started)
+            stats_add(STAT_LOBBIES_PLAYING, -1);
+        else if (!session->ended && timer_pending(&session->timer))
+            stats_add(STAT_LOBBIES_COUNTDOWN, -1);
+        timer_cancel(&session->timer);
+        timer_cancel(&session->board_timer);
+    }
+    if (remove_player(list_g, session, client) > 0)
+    {
+        char disconnect_buf[UUID_LEN + 32];
+        sprintf(disconnect_buf, "player %s has disconnected", client->uuid);
+        notify_all_players(session, NULL, event_simple("info", NULL, disconnect_buf), NULL, 0);
+    }
+}
+
+static void client_release(reactor_handler_t *handler)
+{
+    client_t *client = (client_t *)handler;
+    outq_clear(&client->outq);
+    pool_put(&worker_of(client->shard)->client_pool, client);
+}
+
+static void client_close(client_t *client)
+{
+    if (client->state == CLIENT_CLOSED)
+        return;
+
+    leave_session(client);
+    if (client->indexed)
+    {
+        uuidmap_remove(&players_g, &client->uuid_key);
+        client->indexed = 0;
+    }
+    timer_cancel(&client->close_timer);
+    timer_cancel(&client->park_timer);
+    client->state = CLIENT_CLOSED;
+    client_unlink(client);
+
+    // a parked client has no socket anymore, and was already
+    // taken out of the active ones
+    reactor_release(&client->shard->reactor, &client->handler);
+    if (client->socket >= 0)
+    {
+        // last chance for the final events (bye, timeout...) to leave
+        outq_flush(&client->outq, client->socket);
+        close(client->socket);
+        atomic_fetch_sub(&active_clients_g, 1);
+    }
+    client->socket = -1;
+    client->handler.fd = -1;
+
+    const outq_t *q = &client->outq;
+    log_client(LOG_DEBUG, client, "Output queue: left=%zu peak=%zu sent=%lu events/%lu bytes dropped=%lu", q->bytes,
+               q->peak_bytes, q->sent_msgs, q->sent_bytes, q->dropped_msgs);
+}
+
+// the connection of a player in a running game dropped: the player keeps its
+// seat and its progress for RECONNECT_GRACE_SEC, waiting for a
+// handshake with the same uuid. The client_t stays out of the reactor
+// until then
+static void client_park(client_t *client)
+{
+    log_client(LOG_INFO, client, "Client lost connection, keeping its seat for %ds", RECONNECT_GRACE_SEC);
+
+    reactor_del(&client->shard->reactor, &client->handler);
+    close(client->socket);
+    client->socket = -1;
+    client->handler.fd = -1;
+    outq_clear(&client->outq);
+    linebuf_init(&client->inbuf);
+    timer_cancel(&client->close_timer);
+    // away is not idle: resuming arms the timer again
+    timer_cancel(&client->idle_timer);
+    client->state = CLIENT_PARKED;
+    timer_add(client_timers(client), &client->park_timer, RECONNECT_GRACE_SEC * 1000);
+    atomic_fetch_sub(&active_clients_g, 1);
+
+    notify_all_players(client->session, client,
+                       event_with_uuid("info", client->name, "player lost connection", client->uuid), NULL, 0);
+}
+
+// the socket failed or was closed by the peer, without the player asking
+// to leave: players in the middle of a game can still come back. A lobby
+// that hasn't started just loses the player, it would otherwise count an
+// absent one towards the countdown
+static void client_drop(client_t *client)
+{
+    if (client->state == CLIENT_IN_SESSION && client->session->has_started && !client->session->ended)
+        client_park(client);
+    else
+        client_close(client);
+}
+
+static void on_deferred_close(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    client_t *client = (client_t *)arg;
+    if (client->lost)
+        client_drop(client);
+    else
+        client_close(client);
+}
+
+static void on_park_timeout(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    client_t *client = (client_t *)arg;
+
+    log_client(LOG_INFO, client, "Client didn't come back, giving up its seat");
+    stats_inc(STAT_KICK_NOT_BACK);
+    client_close(client);
+}
+
+static void on_idle_timeout(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    client_t *client = (client_t *)arg;
+
+    send_event(client, "inactive_timeout", NULL, "Kicked after 60s of inactivity");
+    log_client(LOG_INFO, client, "Kicking client for inactivity");
+    stats_inc(STAT_KICK_INACTIVE);
+    client_close(client);
+}
+
+// the inactivity deadline counts from the last word sent,
+// or from the start of the game if the player sent nothing yet
+static void arm_idle_timer(client_t *client, const struct timespec *start_ts)
+{
+    struct timespec since = client->last_activity_ts;
+    if (timespec_diff_sec(&since, start_ts) < 0)
+        since = *start_ts;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double left = PLAYER_INACTIVE_KICK_SEC - timespec_diff_sec(&now, &since);
+    timer_add(client_timers(client), &client->idle_timer, left > 0 ? (uint64_t)(left * 1000) : 0);
+}
+
+static void on_grace_tick(tw_timer_t *timer, void *arg)
+{
+    client_t *client = (client_t *)arg;
+
+    client->warnings_sent++;
+    int remaining = COMPLETED_GRACE_SEC - client->warnings_sent * COMPLETED_WARNING_SEC;
+    if (remaining <= 0)
+    {
+        send_event(client, "timeout", NULL, "20 seconds timeout expired, disconnecting");
+        stats_inc(STAT_KICK_COMPLETED);
+        client_close(client);
+        return;
+    }
+
+    send_line(client, event_timeout_warning(remaining));
+    timer_add(client_timers(client), timer, COMPLETED_WARNING_SEC * 1000);
+}
+
+// the result of a player is kept once: when it types its last word,
+// or when the session ends before that
+static void record_result(client_t *client, int completed)
+{
+    session_t *session = client->session;
+    metrics_snapshot_t m;
+    metrics_get(&client->metrics, session, &client->last_activity_ts, &m);
+
+    struct timespec now, wall;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    clock_gettime(CLOCK_REALTIME, &wall);
+    double elapsed = timespec_diff_sec(completed ? &client->last_activity_ts : &now, &session->start_ts);
+
+    result_rec_t rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.uuid, client->uuid_key.key, sizeof(uuid_t));
+    strncpy(rec.name, client->name, sizeof(rec.name));
+    rec.finished_ms = (int64_t)wall.tv_sec * 1000 + wall.tv_nsec / 1000000;
+    rec.seed = session->seed;
+    strncpy(rec.dict, session->dict->name, sizeof(rec.dict));
+    rec.duration_ms = elapsed > 0 ? (uint32_t)(elapsed * 1000) : 0;
+    rec.words = (uint16_t)client->word_counter;
+    rec.wpm = (uint16_t)m.wpm;
+    rec.raw_wpm = (uint16_t)m.raw_wpm;
+    rec.accuracy = (uint8_t)m.accuracy;
+    rec.completed = (uint8_t)completed;
+    results_add(&rec);
+}
+
+static void end_session(session_t *session)
+{
+    client_t *players[MAX_LOBBY_COUNT];
+    int n = 0;
+
+    session->ended = 1;
+    stats_add(STAT_LOBBIES_PLAYING, -1);
+    for (int i = 0; i < MAX_LOBBY_COUNT; i++)
+        if (session->players[i])
+            players[n++] = session->players[i];
+
+    for (int i = 0; i < n; i++)
+        if (players[i]->state != CLIENT_COMPLETED)
+            record_result(players[i], 0);
+
+    notify_all_players(session, NULL, event_simple("session_end", NULL, "Session closed after 10 minutes"), NULL, 0);
+
+    // the last client_close frees the session, don't touch it from here on
+    for (int i = 0; i < n; i++)
+    {
+        send_event(players[i], "session_end", NULL, "Closing session");
+        stats_inc(STAT_KICK_SESSION_END);
+        client_close(players[i]);
+    }
+}
+
+// current values of the scoreboard fields of a player. The speeds are
+// taken at its last word, so they only change when it types
+static void board_values(client_t *p, session_t *session, int *v)
+{
+    metrics_snapshot_t m;
+    metrics_get(&p->metrics, session, &p->last_activity_ts, &m);
+    v[0] = p->word_counter;
+    v[1] = m.wpm;
+    v[2] = m.raw_wpm;
+    v[3] = m.accuracy;
+    v[4] = m.instant_wpm;
+    v[5] = p->cursor.len;
+    v[6] = p->cursor.ok < p->cursor.len;
 }
 
-void *session_countdown(void *arg)
+// progress is not sent as it happens: the lobby gets at most one
+// scoreboard per tick, with only the players that made progress since
+// the previous one, and only the fields that changed
+static void on_board_timer(tw_timer_t *timer, void *arg)
 {
+    (void)timer;
     session_t *session = (session_t *)arg;
+    event_board_t players[MAX_LOBBY_COUNT];
+    int n = 0;
+    uint64_t now = lat_now();
+
+    for (int i = 0; i < MAX_LOBBY_COUNT; i++)
+    {
+        client_t *p = session->players[i];
+        if (!p || !p->board_dirty)
+            continue;
+        p->board_dirty = 0;
+        lat_record(LAT_BOARD_WAIT, now - p->dirty_ns);
+
+        event_board_t *e = &players[n];
+        board_values(p, session, e->values);
+        e->mask = 0;
+        for (int f = 0; f < BOARD_FIELDS; f++)
+            if (e->values[f] != p->board_sent[f])
+                e->mask |= 1u << f;
+        if (!e->mask)
+            continue;
+
+        memcpy(p->board_sent, e->values, sizeof(p->board_sent));
+        e->uuid = p->uuid;
+        e->uuid_bin = p->uuid_key.key;
+        n++;
+    }
 
-    pthread_mutex_lock(&session->lock);
-    session->countdown_running = 1;
-    pthread_mutex_unlock(&session->lock);
+    if (n == 0)
+        return;
+
+    evbuf_t *json = event_scoreboard(players, n);
+    evbuf_t *bin = wire_scoreboard(players, n);
+    lat_lap(LAT_ENCODE, &now);
+    notify_all_players(session, NULL, json, bin, 1);
+}
+
+static void mark_progress(client_t *client)
+{
+    session_t *session = client->session;
+    if (!client->board_dirty)
+        client->dirty_ns = lat_now();
+    client->board_dirty = 1;
+    if (!timer_pending(&session->board_timer))
+        timer_add(session_timers(session), &session->board_timer, (uint64_t)board_interval_ms_g);
+}
+
+// a player coming back gets the whole scoreboard as the lobby last saw
+// it, the next ticks bring it up to date
+static void send_full_board(client_t *client, session_t *session)
+{
+    event_board_t players[MAX_LOBBY_COUNT];
+    int n = 0;
 
-    for (int i = 10; i >= 1; i--)
+    for (int i = 0; i < MAX_LOBBY_COUNT; i++)
     {
-        cJSON *d = cJSON_CreateObject();
-        if (d)
-            cJSON_AddNumberToObject(d, "value", i);
-        notify_all_players_event(session, NULL, "countdown", NULL, NULL, d);
-        sleep(1);
+        client_t *p = session->players[i];
+        if (!p)
+            continue;
+        players[n].uuid = p->uuid;
+        players[n].uuid_bin = p->uuid_key.key;
+        players[n].mask = BOARD_ALL;
+        memcpy(players[n].values, p->board_sent, sizeof(p->board_sent));
+        n++;
     }
 
-    pthread_mutex_lock(&session->lock);
+    if (client->binary)
+        send_encoded(client, wire_scoreboard(players, n));
+    else
+        send_line(client, event_scoreboard(players, n));
+}
+
+static void start_game(session_t *session)
+{
+    client_t *players[MAX_LOBBY_COUNT];
+    int n = 0;
+
+    session_close_joins(list_g, session);
+    timer_init(&session->board_timer, on_board_timer, session);
+
     session->has_started = 1;
+    log_write(LOG_INFO, session->slot, NULL, "Game started: dict=%s seed=%016llx", session->dict->name,
+              (unsigned long long)session->seed);
+    stats_add(STAT_LOBBIES_COUNTDOWN, -1);
+    stats_inc(STAT_LOBBIES_PLAYING);
     session->clock = clock(); // legacy
     clock_gettime(CLOCK_MONOTONIC, &session->start_ts);
-    pthread_mutex_unlock(&session->lock);
+    struct timespec start_ts = session->start_ts;
+    for (int i = 0; i < MAX_LOBBY_COUNT; i++)
+        if (session->players[i])
+            players[n++] = session->players[i];
+
+    notify_all_players(session, NULL, event_words(session->dict, session->words, WORD_CHUNK),
+                       wire_words(session->dict, session->words, WORD_CHUNK), 0);
+
+    for (int i = 0; i < n; i++)
+        arm_idle_timer(players[i], &start_ts);
+}
+
+// the session timer first ticks the countdown once per second,
+// then starts the game and waits for the hard timeout
+static void on_session_timer(tw_timer_t *timer, void *arg)
+{
+    session_t *session = (session_t *)arg;
+
+    int started = session->has_started;
+    int value = session->countdown_left;
+    if (!started && value > 0)
+        session->countdown_left--;
 
-    cJSON *words = cJSON_CreateArray();
-    if (words)
+    if (started)
     {
-        for (int i = 0; i < WORD_CHUNK; i++)
-        {
-            cJSON_AddItemToArray(words, cJSON_CreateString(session->list[i]));
-        }
-        cJSON *d = cJSON_CreateObject();
-        if (d)
-        {
-            cJSON_AddItemToObject(d, "words", words);
-            notify_all_players_event(session, NULL, "words", NULL, NULL, d);
-        }
-        else
-        {
-            cJSON_Delete(words);
-        }
+        end_session(session);
+        return;
     }
 
-    pthread_mutex_lock(&session->lock);
-    session->countdown_running = 0;
-    pthread_mutex_unlock(&session->lock);
-    return NULL;
+    if (value > 0)
+    {
+        notify_all_players(session, NULL, event_countdown(value), NULL, 0);
+        timer_add(session_timers(session), timer, 1000);
+        return;
+    }
+
+    start_game(session);
+    timer_add(session_timers(session), timer, SESSION_HARD_TIMEOUT_SEC * 1000);
 }
 
-void *handle_client(void *arg)
+static void start_countdown(session_t *session)
 {
-    client_t *client = (client_t *)arg;
+    session->countdown_left = session->countdown_sec;
+    stats_inc(STAT_LOBBIES_COUNTDOWN);
+    timer_init(&session->timer, on_session_timer, session);
+    timer_add(session_timers(session), &session->timer, 0);
+}
+
+// a player that gets in a game already going gets the words and the
+// scoreboard, and its inactivity deadline counts from the start
+static void send_game_state(client_t *client, session_t *session)
+{
+    if (client->binary)
+        send_encoded(client, wire_words(session->dict, session->words, WORD_CHUNK));
+    else
+        send_line(client, event_words(session->dict, session->words, WORD_CHUNK));
+    arm_idle_timer(client, &session->start_ts);
+    send_full_board(client, session);
+}
+
+// takes the seat reserved by find_free_session, on the shard of the
+// lobby. The client may get there late, once the game has started
+static int seat_player(client_t *client, session_t *session)
+{
+    if (!add_player(session, client))
+    {
+        send_event(client, "error", NULL, "failed to add player to session");
+        return 0;
+    }
+
+    client->state = CLIENT_IN_SESSION;
+    client->word_counter = 0;
+    metrics_reset(&client->metrics);
+    cursor_reset(&client->cursor);
+    client->board_dirty = 0;
+    memset(client->board_sent, 0, sizeof(client->board_sent));
     client->last_activity_ts.tv_sec = 0;
     client->last_activity_ts.tv_nsec = 0;
 
-    cJSON *uuid_tmp = NULL;
+    // we need to notify the player that it has been added to a lobby, and
+    // send a list of all the players that are already in the lobby
+    // so the UI can be initialized correctly
+    send_line(client, build_lobby_event(session, client));
+    notify_all_players(session, client,
+                       event_with_uuid("info", client->name, "player joined the lobby", client->uuid), NULL, 0);
 
-    // in order to add the player to a session, the first message
-    // he sends needs to be formatted like this:
-    //
-    // { "name": "...", "uuid": "..." }
-    char buf[1024] = {0};
-    int n = recv(client->socket, buf, sizeof(buf) - 1, 0);
-    if (n <= 0)
+    if (session->ended)
+    {
+        send_event(client, "session_end", NULL, "Closing session");
+        return 0;
+    }
+    if (session->has_started)
+        send_game_state(client, session);
+    else if (session->seated >= 2 && !timer_pending(&session->timer))
+    {
+        log_write(LOG_INFO, session->slot, NULL, "Starting countdown for session with %d players", session->seated);
+        start_countdown(session);
+    }
+    return 1;
+}
+
+// the client is handed over to another shard once the event being
+// handled is over, see client_hand_over: the caller may still look at it
+static void client_move(client_t *client, int shard)
+{
+    client->state = CLIENT_MOVING;
+    client->move_to = shard;
+}
+
+// with the client being verified, we can now call the
+// function find_free_session and try to add him to any free lobby.
+// The lobby may be run by another shard: the client then moves there
+// and takes its seat on that thread
+static int join_session(client_t *client)
+{
+    // a client about to be closed doesn't go anywhere
+    if (timer_pending(&client->close_timer))
+        return 0;
+
+    int pcount = 0;
+    session_t *session = find_free_session(list_g, client->dict, client->shard->id, &pcount);
+    if (!session)
+    {
+        send_event(client, "error", NULL, "couldn't find available session");
+        return 0;
+    }
+
+    client->session = session;
+    log_client(LOG_INFO, client, "Player added to session. Current count: %d", pcount);
+    if (session->shard != client->shard->id)
+    {
+        client_move(client, session->shard);
+        return 1;
+    }
+    return seat_player(client, session);
+}
+
+// the new connection takes the place of the parked one: same seat,
+// same progress, and the game goes on from the word it was at. Both
+// are on the shard of the lobby
+static int resume_session(client_t *client, client_t *parked)
+{
+    session_t *session = parked->session;
+
+    uuidmap_replace(&players_g, &parked->uuid_key, &client->uuid_key);
+    parked->indexed = 0;
+    client->indexed = 1;
+
+    client->session = session;
+    client->seat = parked->seat;
+    client->dict = parked->dict;
+    client->word_counter = parked->word_counter;
+    client->metrics = parked->metrics;
+    client->cursor = parked->cursor;
+    client->board_dirty = parked->board_dirty;
+    client->dirty_ns = parked->dirty_ns;
+    memcpy(client->board_sent, parked->board_sent, sizeof(client->board_sent));
+    client->last_activity_ts = parked->last_activity_ts;
+    client->state = CLIENT_IN_SESSION;
+    session->players[client->seat] = client;
+
+    // the parked client goes away without leaving the session
+    parked->session = NULL;
+    parked->seat = -1;
+    client_close(parked);
+
+    log_client(LOG_INFO, client, "Client resumed at word %d", client->word_counter);
+
+    send_line(client, build_lobby_event(session, client));
+    if (session->has_started)
+        send_game_state(client, session);
+    send_line(client, event_resumed(client->uuid, client->word_counter));
+    notify_all_players(session, client,
+                       event_with_uuid("info", client->name, "player reconnected", client->uuid), NULL, 0);
+    return 1;
+}
+
+// the same player can't be connected twice, but it can take back the
+// seat it had before losing the connection. The client holding the
+// uuid can only be looked at from its own shard, so the new one moves
+// there first and checks again
+static int claim_uuid(client_t *client)
+{
+    int self = client->shard->id;
+
+    atomic_store(&client->uuid_key.home, self);
+    while (uuidmap_insert(&players_g, &client->uuid_key) < 0)
     {
-        printf("Couldn't verify user\n");
-        goto cleanup;
+        int home = uuidmap_home(&players_g, client->uuid_key.key);
+        if (home < 0)
+            continue; // it just left
+        if (home != self)
+        {
+            client_move(client, home);
+            return 1;
+        }
+
+        uuid_entry_t *owner = uuidmap_find(&players_g, client->uuid_key.key);
+        if (!owner)
+            continue;
+        client_t *other = (client_t *)((char *)owner - offsetof(client_t, uuid_key));
+        if (other->state == CLIENT_PARKED)
+            return resume_session(client, other);
+
+        send_event(client, "error", NULL, "uuid already connected");
+        return 0;
     }
+    client->indexed = 1;
+
+    log_client(LOG_INFO, client, "Client connected: name=%s", client->name);
 
-    buf[n] = '\0';
+    return join_session(client);
+}
+
+// in order to add the player to a session, the first message
+// he sends needs to be formatted like this:
+//
+// { "name": "...", "uuid": "...", "dict": "...", "proto": "json|bin" }
+//
+// where "dict" is optional and picks the word list to play with, and
+// "proto" switches the connection to the binary protocol (see wire.h)
+static int handle_handshake(client_t *client, const char *buf)
+{
     cJSON *json = cJSON_Parse(buf);
     if (!json)
     {
-        send_event(client->socket, "error", NULL, "invalid format", NULL);
-        goto cleanup;
+        send_event(client, "error", NULL, "invalid format");
+        return 0;
     }
 
     cJSON *uuid_json = cJSON_GetObjectItemCaseSensitive(json, "uuid");
@@ -211,9 +819,39 @@ void *handle_client(void *arg)
         strlen(uuid_json->valuestring) >= UUID_LEN ||
         strlen(name_json->valuestring) >= NAME_MAX_LEN)
     {
-        send_event(client->socket, "error", NULL, "invalid parameters", NULL);
+        send_event(client, "error", NULL, "invalid parameters");
         cJSON_Delete(json);
-        goto cleanup;
+        return 0;
+    }
+
+    // from here on the replies already follow the protocol asked for
+    cJSON *proto_json = cJSON_GetObjectItemCaseSensitive(json, "proto");
+    if (cJSON_IsString(proto_json))
+    {
+        if (strcmp(proto_json->valuestring, "bin") == 0)
+            client->binary = 1;
+        else if (strcmp(proto_json->valuestring, "json") != 0)
+        {
+            send_event(client, "error", NULL, "unknown protocol");
+            cJSON_Delete(json);
+            return 0;
+        }
+    }
+
+    cJSON *dict_json = cJSON_GetObjectItemCaseSensitive(json, "dict");
+    client->dict = cJSON_IsString(dict_json) ? dict_find(dict_json->valuestring) : dict_default();
+    if (!client->dict)
+    {
+        send_event(client, "error", NULL, "unknown dictionary");
+        cJSON_Delete(json);
+        return 0;
+    }
+
+    if (uuid_parse(uuid_json->valuestring, client->uuid_key.key) != 0)
+    {
+        send_event(client, "error", NULL, "invalid uuid");
+        cJSON_Delete(json);
+        return 0;
     }
 
     strncpy(client->uuid, uuid_json->valuestring, UUID_LEN - 1);
@@ -222,306 +860,658 @@ void *handle_client(void *arg)
     client->name[NAME_MAX_LEN - 1] = '\0';
     cJSON_Delete(json);
 
-    printf("Client connected: name=%s uuid=%s\n", client->name, client->uuid);
+    return claim_uuid(client);
+}
+
+// what a player in a lobby can ask, in either protocol
+typedef enum session_req_e
+{
+    REQ_NONE,
+    REQ_DISCONNECT,
+    REQ_NEW_LOBBY,
+    REQ_WORD
+} session_req_t;
+
+static inline int word_matches(const session_t *session, int i, const char *word, size_t len)
+{
+    return (size_t)session_word_len(session, i) == len &&
+           memcmp(session_word(session, i), word, len) == 0;
+}
 
-    // with the client being verified, we can now call the
-    // function find_free_session and try to add him to any free lobby
+// handles a request of a client that is in a lobby. Binary clients
+// reference the word they typed by its index, the JSON ones always
+// type the current word (index -1). Returns 0 when the connection
+// has to be closed
+static int handle_session_request(client_t *client, session_req_t req,
+                                  const char *word, size_t len, long index)
+{
+    session_t *session = client->session;
 
-    // semi-colon needed since a declaration is not permitted after a goto
-lobby_changed:;
+    int game_started = session->has_started;
 
-    session_t *tmp = find_free_session(list_g);
-    if (!tmp)
+    // the only two messages the client is allowed to send
+    // (even if the game has not started yet) are request
+    // to either disconnect or change lobby
+    //
+    // NOTE: when a player is added to a lobby, he will actually
+    //       be able to change it only when the game has started
+    //       (he has to play in the lobby it was just added.)
+    if (req == REQ_DISCONNECT)
     {
-        send_event(client->socket, "error", NULL, "couldn't find available session", NULL);
-        goto cleanup;
+        send_event(client, "bye", NULL, "Disconnected on request");
+        return 0;
     }
 
-    int pcount = add_player(tmp, client);
-    if (pcount == 0)
+    if (req == REQ_NEW_LOBBY && game_started)
     {
-        send_event(client->socket, "error", NULL, "failed to add player to session", NULL);
-        goto cleanup;
+        send_event(client, "info", NULL, "change_lobby request accepted");
+        leave_session(client);
+        return join_session(client);
     }
 
-    printf("Player added to session. Current count: %d\n", pcount);
+    if (!game_started)
+        return 1;
 
-    // we need to notify the player that it has been added to a lobby, and
-    // send a list of all the players that are already in the lobby
-    // so the UI can be initialized correctly
-    cJSON *players_list = build_players_list_obj(tmp, client->uuid);
-    if (!players_list)
+    if (req != REQ_WORD)
     {
-        goto cleanup;
+        send_event(client, "error", NULL, "json parsing failed");
+        return 1;
     }
 
-    send_event(client->socket, "lobby", NULL, "added to lobby", players_list);
+    // a word that was already accepted is a retransmission,
+    // e.g. of a client that reconnected
+    if (index >= 0 && index < client->word_counter)
+        return 1;
 
-    uuid_tmp = cJSON_CreateObject();
-    if (!uuid_tmp)
-        exit(EXIT_FAILURE);
-    cJSON_AddStringToObject(uuid_tmp, "uuid", client->uuid);
+    clock_gettime(CLOCK_MONOTONIC, &client->last_activity_ts);
+    if (timer_pending(&client->idle_timer))
+        timer_add(client_timers(client), &client->idle_timer, PLAYER_INACTIVE_KICK_SEC * 1000);
+
+    uint64_t t = lat_now();
+    int correct = client->word_counter < WORD_CHUNK &&
+                  (index < 0 || index == client->word_counter) &&
+                  word_matches(session, client->word_counter, word, len);
+    metrics_on_word(&client->metrics, session, &client->last_activity_ts, (int)len, correct);
+    lat_record(LAT_CHECK, lat_now() - t);
+    stats_inc(correct ? STAT_WORDS_CORRECT : STAT_WORDS_WRONG);
+
+    if (correct)
+        client->word_counter++;
+    mark_progress(client);
+
+    if (client->word_counter >= WORD_CHUNK)
+    {
+        record_result(client, 1);
+        send_line(client,
+                  event_with_uuid("completed", client->name,
+                                  "All words completed! You have 20 seconds before disconnect", client->uuid));
+
+        client->state = CLIENT_COMPLETED;
+        client->warnings_sent = 0;
+        timer_cancel(&client->idle_timer);
+        timer_add(client_timers(client), &client->grace_timer, COMPLETED_WARNING_SEC * 1000);
+    }
+    return 1;
+}
+
+// streaming input: a batch of keystrokes moves the cursor of the
+// player, and every space submits the word typed so far like a
+// whole word message would
+static int handle_keys(client_t *client, const char *keys, size_t len)
+{
+    session_t *session = client->session;
+
+    if (!session->has_started)
+        return 1;
+
+    cursor_t *c = &client->cursor;
+    for (size_t i = 0; i < len && client->state == CLIENT_IN_SESSION; i++)
+    {
+        if (cursor_key(c, session, client->word_counter, keys[i]) != CURSOR_SUBMIT)
+            continue;
+
+        // a word longer than the buffer can't be right: an index past
+        // the current word makes it count as a wrong one
+        long index = c->len > WORD_MAX_LEN ? WORD_CHUNK : -1;
+        int ret = handle_session_request(client, REQ_WORD, c->typed, (size_t)c->len, index);
+        cursor_reset(c);
+        if (!ret)
+            return 0;
+    }
+
+    if (client->state == CLIENT_IN_SESSION && timer_pending(&client->idle_timer))
+        timer_add(client_timers(client), &client->idle_timer, PLAYER_INACTIVE_KICK_SEC * 1000);
+    if (len > 0)
+        mark_progress(client);
+    return 1;
+}
+
+static int handle_session_message(client_t *client, const char *buf)
+{
+    uint64_t t = lat_now();
+    cJSON *msg = cJSON_Parse(buf);
+    if (!msg)
+        return 1;
+
+    session_req_t req = REQ_NONE;
+    const char *word = NULL;
+    cJSON *type = cJSON_GetObjectItemCaseSensitive(msg, "type");
+    cJSON *word_item = cJSON_GetObjectItemCaseSensitive(msg, "word");
+    cJSON *keys_item = cJSON_GetObjectItemCaseSensitive(msg, "keys");
+    lat_record(LAT_PARSE, lat_now() - t);
+    if (cJSON_IsString(keys_item))
+    {
+        int ret = handle_keys(client, keys_item->valuestring, strlen(keys_item->valuestring));
+        cJSON_Delete(msg);
+        return ret;
+    }
+    if (cJSON_IsString(type) && strcmp(type->valuestring, "disconnect") == 0)
+        req = REQ_DISCONNECT;
+    else if (cJSON_IsString(type) && strcmp(type->valuestring, "new_lobby_request") == 0)
+        req = REQ_NEW_LOBBY;
+    else if (cJSON_IsString(word_item))
+    {
+        req = REQ_WORD;
+        word = word_item->valuestring;
+    }
+
+    int ret = handle_session_request(client, req, word, word ? strlen(word) : 0, -1);
+    cJSON_Delete(msg);
+    return ret;
+}
 
-    notify_all_players_event(tmp, client, "info", client->name, "player joined the lobby", cJSON_Duplicate(uuid_tmp, 1));
-    if (pcount == 2)
+static int handle_session_frame(client_t *client, const unsigned char *frame, size_t len)
+{
+    const unsigned char *p = frame + 1, *end = frame + len;
+    switch (frame[0])
+    {
+    case WOP_WORD:
+    {
+        uint64_t t = lat_now();
+        uint64_t index;
+        const char *word;
+        size_t word_len;
+        if (!wire_get_varint(&p, end, &index) || !wire_get_str(&p, end, &word, &word_len))
+        {
+            send_event(client, "error", NULL, "malformed frame");
+            return 1;
+        }
+        lat_record(LAT_PARSE, lat_now() - t);
+        return handle_session_request(client, REQ_WORD, word, word_len,
+                                      index > WORD_CHUNK ? WORD_CHUNK : (long)index);
+    }
+    case WOP_KEYS:
     {
-        printf("Starting countdown for session with 2 players\n");
-        if (pthread_create(&tmp->countdown_tid, NULL, session_countdown, (void *)tmp) != 0)
+        const char *keys;
+        size_t keys_len;
+        if (!wire_get_str(&p, end, &keys, &keys_len))
         {
-            perror("failed to create countdown thread");
-            send_event(client->socket, "error", NULL, "failed to start game", NULL);
-            goto cleanup;
+            send_event(client, "error", NULL, "malformed frame");
+            return 1;
         }
+        return handle_keys(client, keys, keys_len);
+    }
+    case WOP_DISCONNECT:
+        return handle_session_request(client, REQ_DISCONNECT, NULL, 0, -1);
+    case WOP_NEW_LOBBY:
+        return handle_session_request(client, REQ_NEW_LOBBY, NULL, 0, -1);
+    default:
+        send_event(client, "error", NULL, "unknown opcode");
+        return 1;
     }
+}
 
-    // 3) loop di gioco
-    int word_counter = 0;
-    int lobby_change = 0;
-    while (1)
+static int handle_frame(client_t *client, const unsigned char *frame, size_t len)
+{
+    switch (client->state)
     {
-        struct timespec now;
-        clock_gettime(CLOCK_MONOTONIC, &now);
+    case CLIENT_IN_SESSION:
+        return handle_session_frame(client, frame, len);
+    case CLIENT_COMPLETED:
+        return 1;
+    default:
+        return 0;
+    }
+}
 
-        int should_end = 0;
-        pthread_mutex_lock(&tmp->lock);
-        int game_started = tmp->has_started;
-        int already_ended = tmp->ended;
-        struct timespec start_ts = tmp->start_ts;
-        pthread_mutex_unlock(&tmp->lock);
+static int handle_message(client_t *client, const char *buf)
+{
+    switch (client->state)
+    {
+    case CLIENT_HANDSHAKE:
+        return handle_handshake(client, buf);
+    case CLIENT_IN_SESSION:
+        return handle_session_message(client, buf);
+    case CLIENT_COMPLETED:
+        // the player has nothing left to type, input is drained and ignored
+        return 1;
+    default:
+        return 0;
+    }
+}
 
-        if (game_started && !already_ended)
+// handles every complete message in the receive ring. The handshake is
+// always a JSON line, and it may switch the rest of the stream to
+// binary frames. Returns 0 when the connection has to be closed
+static int handle_input(client_t *client, char *scratch)
+{
+    while (client_here(client))
+    {
+        if (client->binary)
         {
-            double elapsed_session = timespec_diff_sec(&now, &start_ts);
-            if (elapsed_session >= SESSION_HARD_TIMEOUT_SEC)
+            unsigned char *frame;
+            size_t len;
+            int r = linebuf_next_frame(&client->inbuf, &frame, &len, scratch);
+            if (r == 0)
+                return 1;
+            if (r < 0)
             {
-                pthread_mutex_lock(&tmp->lock);
-                if (!tmp->ended)
-                {
-                    tmp->ended = 1;
-                    should_end = 1;
-                }
-                pthread_mutex_unlock(&tmp->lock);
-                if (should_end)
-                {
-                    notify_all_players_event(tmp, NULL, "session_end", NULL, "Session closed after 10 minutes", NULL);
-                }
+                send_event(client, "error", NULL, "malformed frame");
+                stats_inc(STAT_KICK_BAD_INPUT);
+                return 0;
             }
+            if (!handle_frame(client, frame, len))
+                return 0;
+            continue;
         }
-        pthread_mutex_lock(&tmp->lock);
-        int ended_now = tmp->ended;
-        pthread_mutex_unlock(&tmp->lock);
-        if (ended_now)
-        {
-            send_event(client->socket, "session_end", NULL, "Closing session", NULL);
-            break;
-        }
 
-        char inbuf[1024];
-        int r = recv(client->socket, inbuf, sizeof(inbuf) - 1, MSG_DONTWAIT);
+        char *line;
+        if (!linebuf_next(&client->inbuf, &line, scratch))
+            return 1;
+        if (line[0] == '\0')
+            continue;
+        if (!handle_message(client, line))
+            return 0;
+    }
+    return 1;
+}
+
+static void on_adopt(shard_t *shard, shard_msg_t *msg);
+
+// from here on the client belongs to the other shard, which gets it
+// through its inbox: this thread must not touch it anymore
+static void client_hand_over(client_t *client)
+{
+    worker_t *to = &workers_g[client->move_to];
+
+    reactor_del(&client->shard->reactor, &client->handler);
+    client_unlink(client);
+    timer_cancel(&client->idle_timer);
+    timer_cancel(&client->grace_timer);
+    atomic_store(&client->uuid_key.home, client->move_to);
+    client->shard = &to->shard;
+    client->handoff.run = on_adopt;
+    stats_inc(STAT_HANDOFFS);
+    shard_post(&to->shard, &client->handoff);
+}
+
+// a client arrives either with a seat reserved in a lobby of this
+// shard, or still in the handshake, to claim its uuid here. What it
+// sent in the meantime is still in its ring, and the socket readiness
+// is reported again once registered
+static void on_adopt(shard_t *shard, shard_msg_t *msg)
+{
+    client_t *client = (client_t *)((char *)msg - offsetof(client_t, handoff));
+    char scratch[LINEBUF_SIZE];
+
+    client_link(client);
+    int ok = reactor_add(&shard->reactor, &client->handler, CLIENT_EVENTS) == 0;
+    if (!ok)
+        log_client(LOG_ERROR, client, "failed to register client socket: %s", strerror(errno));
 
+    if (client->session)
+        ok = seat_player(client, client->session) && ok;
+    else if (ok)
+    {
+        client->state = CLIENT_HANDSHAKE;
+        ok = claim_uuid(client);
+    }
+
+    if (ok && client_here(client))
+        ok = handle_input(client, scratch);
+    if (!ok)
+        client_close(client);
+    else if (client->state == CLIENT_MOVING)
+        client_hand_over(client);
+}
+
+// sockets are registered edge-triggered, so every readable
+// notification must drain the socket until it would block. Messages
+// are newline delimited: each read may carry several of them, or
+// just a part of one, which stays in the ring until completed
+static void on_client_event(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    (void)reactor;
+    client_t *client = (client_t *)handler;
+    char scratch[LINEBUF_SIZE];
+
+    if (events & EPOLLERR)
+    {
+        client_drop(client);
+        return;
+    }
+
+    if ((events & EPOLLOUT) && outq_flush(&client->outq, client->socket) < 0)
+    {
+        client_drop(client);
+        return;
+    }
+
+    while (client_here(client))
+    {
+        uint64_t t = lat_now();
+        ssize_t r = linebuf_recv(&client->inbuf, client->socket);
+        if (r > 0)
+            lat_record(LAT_RECV, lat_now() - t);
+
+        if (r == 0 && linebuf_full(&client->inbuf))
+        {
+            send_event(client, "error", NULL, "message too long");
+            stats_inc(STAT_KICK_BAD_INPUT);
+            client_close(client);
+            return;
+        }
         if (r == 0)
         {
-            printf("Client %s disconnected\n", client->uuid);
-            break;
+            if (client->state == CLIENT_HANDSHAKE)
+                log_client(LOG_INFO, client, "Couldn't verify user");
+            else
+                log_client(LOG_INFO, client, "Client disconnected");
+            client_drop(client);
+            return;
         }
-        else if (r < 0)
+        if (r < 0)
         {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-                // kick per inattività
-                if (game_started)
-                {
-                    if (client->last_activity_ts.tv_sec == 0 && client->last_activity_ts.tv_nsec == 0)
-                        client->last_activity_ts = start_ts;
-                    double idle = timespec_diff_sec(&now, &client->last_activity_ts);
-                    if (idle >= PLAYER_INACTIVE_KICK_SEC)
-                    {
-                        send_event(client->socket, "inactive_timeout", NULL, "Kicked after 60s of inactivity", NULL);
-                        printf("Kicking %s for inactivity\n", client->uuid);
-                        break;
-                    }
-                }
-                struct timespec ts = {.tv_sec = 0, .tv_nsec = 1 * 1000 * 1000}; // 1 ms
-                nanosleep(&ts, NULL);
+            if (errno == EINTR)
                 continue;
-            }
-            else
-            {
-                printf("Error receiving from client %s: %s\n", client->uuid, strerror(errno));
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
                 break;
-            }
+            log_client(LOG_WARN, client, "Error receiving from client: %s", strerror(errno));
+            client_drop(client);
+            return;
         }
-        else
+
+        stats_add(STAT_BYTES_IN, r);
+        if (!handle_input(client, scratch))
         {
-            inbuf[r] = '\0';
+            client_close(client);
+            return;
+        }
+    }
 
-            cJSON *msg = cJSON_Parse(inbuf);
-            if (!msg)
-                continue;
+    if (client->state == CLIENT_MOVING)
+        client_hand_over(client);
+}
 
-            // the only two messages the client is allowed to send
-            // (even if the game has not started yet) are request
-            // to either disconnect or change lobby
-            //
-            // NOTE: when a player is added to a lobby, he will actually
-            //       be able to change it only when the game has started
-            //       (he has to play in the lobby it was just added.)
-            int wants_disconnect = 0;
-            cJSON *type = cJSON_GetObjectItemCaseSensitive(msg, "type");
-            if (type && cJSON_IsString(type))
-            {
-                if (strcmp(type->valuestring, "disconnect") == 0)
-                    wants_disconnect = 1;
-                else if (strcmp(type->valuestring, "new_lobby_request") == 0)
-                    lobby_change = 1;
-            }
+// the socket has just been accepted, so its send buffer is empty and
+// the short notice always fits: it is sent without ever blocking
+static void reject_client(int fd)
+{
+    log_write(LOG_WARN, -1, NULL, "Server full, rejecting connection");
+    const char *msg = "Server is full, try again later\n";
+#ifdef MSG_NOSIGNAL
+    send(fd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    send(fd, msg, strlen(msg), MSG_DONTWAIT);
+#endif
+    close(fd);
+}
 
-            if (wants_disconnect)
-            {
-                send_event(client->socket, "bye", NULL, "Disconnected on request", NULL);
-                cJSON_Delete(msg);
-                break;
-            }
+// every worker accepts on its own listener: the clients start on the
+// shard that accepted them, and move when they join a lobby of another one
+static void on_accept(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    (void)events;
+    worker_t *w = (worker_t *)((char *)handler - offsetof(worker_t, listener));
 
-            if (lobby_change && game_started)
+    for (;;)
+    {
+        struct sockaddr_in address;
+        socklen_t addrlen = sizeof(address);
+        int client_socket = accept(handler->fd, (struct sockaddr *)&address, &addrlen);
+        if (client_socket < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            // the listener is edge triggered: the connections left in the
+            // backlog wouldn't be notified again, so they are picked up
+            // later, when descriptors may have been freed
+            if ((errno == EMFILE || errno == ENFILE) && !timer_pending(&w->accept_retry))
+                timer_add(&reactor->timers, &w->accept_retry, ACCEPT_RETRY_MS);
+            if (reactor->timers.now_ms - w->accept_logged_ms >= ACCEPT_LOG_INTERVAL_MS)
             {
-                send_event(client->socket, "info", NULL, "change_lobby request accepted", NULL);
-                cJSON_Delete(msg);
-                break;
+                log_write(LOG_ERROR, -1, NULL, "failed to accept connection: %s", strerror(errno));
+                w->accept_logged_ms = reactor->timers.now_ms;
             }
+            return;
+        }
 
-            if (!game_started)
-            {
-                cJSON_Delete(msg);
-                continue;
-            }
+        // the slot is taken right away, so that the workers
+        // accepting at the same time can't go over the limit
+        if (atomic_fetch_add(&active_clients_g, 1) >= max_clients_g)
+        {
+            atomic_fetch_sub(&active_clients_g, 1);
+            stats_inc(STAT_REJECTED);
+            reject_client(client_socket);
+            continue;
+        }
 
-            cJSON *word_item = cJSON_GetObjectItemCaseSensitive(msg, "word");
-            if (!word_item || !cJSON_IsString(word_item))
-            {
-                send_event(client->socket, "error", NULL, "json parsing failed", NULL);
-                cJSON_Delete(msg);
-                continue;
-            }
+        if (set_nonblocking(client_socket) < 0)
+        {
+            log_write(LOG_ERROR, -1, NULL, "failed to set client socket non-blocking: %s", strerror(errno));
+            close(client_socket);
+            atomic_fetch_sub(&active_clients_g, 1);
+            continue;
+        }
 
-            client->last_activity_ts = now;
+        client_t *client = pool_get(&w->client_pool);
+        if (!client)
+        {
+            log_write(LOG_ERROR, -1, NULL, "failed to allocate client_t: %s", strerror(errno));
+            close(client_socket);
+            atomic_fetch_sub(&active_clients_g, 1);
+            continue;
+        }
+        memset(client, 0, sizeof(client_t));
+        client->shard = &w->shard;
+        client->seat = -1;
 
-            if (word_counter < WORD_CHUNK &&
-                is_correct(tmp->list[word_counter], word_item->valuestring))
-            {
+        client->socket = client_socket;
+        client->state = CLIENT_HANDSHAKE;
+        client->handler.fd = client_socket;
+        client->handler.on_event = on_client_event;
+        client->handler.on_release = client_release;
+        linebuf_init(&client->inbuf);
+        outq_init(&client->outq);
+        timer_init(&client->idle_timer, on_idle_timeout, client);
+        timer_init(&client->grace_timer, on_grace_tick, client);
+        timer_init(&client->close_timer, on_deferred_close, client);
+        timer_init(&client->park_timer, on_park_timeout, client);
+
+        if (reactor_add(reactor, &client->handler, CLIENT_EVENTS) < 0)
+        {
+            log_write(LOG_ERROR, -1, NULL, "failed to register client socket: %s", strerror(errno));
+            close(client_socket);
+            pool_put(&w->client_pool, client);
+            atomic_fetch_sub(&active_clients_g, 1);
+            continue;
+        }
 
-                word_counter++;
-                int curr_wpm = wpm(tmp, word_counter);
+        client_link(client);
+        stats_inc(STAT_ACCEPTED);
+    }
+}
 
-                cJSON *d_all = cJSON_CreateObject();
-                if (d_all)
-                {
-                    cJSON_AddStringToObject(d_all, "uuid", client->uuid);
-                    cJSON_AddNumberToObject(d_all, "value", curr_wpm);
-                }
-                notify_all_players_event(tmp, NULL, "wpm", NULL, NULL, d_all);
-            }
+static void on_accept_retry(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    worker_t *w = (worker_t *)arg;
+    on_accept(&w->shard.reactor, &w->listener, EPOLLIN);
+}
+
+// what the server keeps outside of the counters, read when scraped
+static void stats_extra(evbuf_t *b)
+{
+    stats_gauge(b, "typel_clients_active", "Connected clients.", atomic_load(&active_clients_g));
+    stats_gauge(b, "typel_clients_max", "Maximum number of clients.", max_clients_g);
+    stats_gauge(b, "typel_lobbies_open", "Lobbies with at least one seat taken.", atomic_load(&list_g->count));
+    stats_gauge(b, "typel_workers", "Worker threads.", nworkers_g);
+    lat_render(b);
+}
 
-            cJSON_Delete(msg);
+// GET /results/<uuid>: the best and the last results of a player
+static const char *admin_route(const char *path, size_t len, evbuf_t *b)
+{
+    static const char prefix[] = "/results/";
+    char text[37]; // text form of a uuid
+    uuid_t uuid;
+    if (len != sizeof(prefix) - 1 + sizeof(text) - 1 || memcmp(path, prefix, sizeof(prefix) - 1) != 0)
+        return NULL;
+    memcpy(text, path + sizeof(prefix) - 1, sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    if (uuid_parse(text, uuid) != 0)
+        return NULL;
 
-            if (word_counter >= WORD_CHUNK)
-            {
-                send_event(client->socket, "completed", client->name,
-                           "All words completed! You have 20 seconds before disconnect", cJSON_Duplicate(uuid_tmp, 1));
-
-                time_t start_timeout = time(NULL);
-                const time_t timeout_duration = 20;
-
-                for (;;)
-                {
-                    pthread_mutex_lock(&tmp->lock);
-                    int ended_mid = tmp->ended;
-                    pthread_mutex_unlock(&tmp->lock);
-                    if (ended_mid)
-                    {
-                        send_event(client->socket, "session_end", NULL, "Closing session", NULL);
-                        goto after_loop;
-                    }
-
-                    time_t elapsed = time(NULL) - start_timeout;
-                    if (elapsed >= timeout_duration)
-                    {
-                        send_event(client->socket, "timeout", NULL, "20 seconds timeout expired, disconnecting", NULL);
-                        goto after_loop;
-                    }
-
-                    char tbuf[256];
-                    int tr = recv(client->socket, tbuf, sizeof(tbuf), MSG_DONTWAIT);
-                    if (tr == 0)
-                        goto after_loop;
-                    if (tr < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
-                        goto after_loop;
-
-                    if (elapsed > 0 && (elapsed % 5) == 0)
-                    {
-                        cJSON *d = cJSON_CreateObject();
-                        if (d)
-                            cJSON_AddNumberToObject(d, "remaining", timeout_duration - elapsed);
-                        send_event(client->socket, "timeout_warning", NULL, NULL, d);
-                    }
-
-                    sleep(1);
-                }
-            }
-        }
-    }
+    results_render(b, uuid);
+    return "application/json";
+}
+
+// SIGUSR1 prints the stage latencies since the previous dump, and the
+// mutex profile of a LOCKPROF build; SIGINT and SIGTERM stop the server.
+// The signals are blocked in every thread, and read from a signalfd by
+// the first worker
+static reactor_handler_t signal_g = {.fd = -1};
 
-after_loop:
-    remove_player(list_g, tmp, client->uuid);
+// handed to the log writer, which owns stdout: the worker never
+// blocks on it, and the report doesn't cut a log line in two
+static void print_buf(const evbuf_t *b)
+{
+    if (!b->oom)
+        log_block(b->data, b->len);
+}
 
-    // here we notify the other players when our client
-    // has disconnected from the lobby, in order to update the UI
-    // we do this only if the player has actually been added to the lobby
-    if (tmp && pcount)
+static void on_signal(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    (void)events;
+    struct signalfd_siginfo si;
+    while (read(handler->fd, &si, sizeof(si)) == (ssize_t)sizeof(si))
     {
-        char disconnect_buf[UUID_LEN + 32];
-        sprintf(disconnect_buf, "player %s has disconnected", client->uuid);
-        notify_all_players_event(tmp, NULL, "info", NULL, disconnect_buf, NULL);
+        if (si.ssi_signo != SIGUSR1)
+        {
+            log_write(LOG_INFO, -1, NULL, "Shutting down");
+            reactor_stop(reactor);
+            continue;
+        }
+        evbuf_t *b = evbuf_get();
+        lat_dump(b);
+        lockprof_report(b);
+        print_buf(b);
     }
+}
 
-    if (lobby_change)
+// must run before the workers start, for them to inherit the mask
+static void listen_signals(reactor_t *reactor)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    signal_g.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    signal_g.on_event = on_signal;
+    signal_g.on_release = NULL;
+    if (signal_g.fd < 0 || reactor_add(reactor, &signal_g, EPOLLIN | EPOLLET) < 0)
     {
-        lobby_change = 0;
-        goto lobby_changed;
+        perror("failed to watch the signals");
+        pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
     }
+}
 
-cleanup:
-    if (uuid_tmp)
-        cJSON_Delete(uuid_tmp);
-    close(client->socket);
-
-    pthread_mutex_lock(&client_lock_g);
-    active_clients_g--;
-    pthread_mutex_unlock(&client_lock_g);
-
-    free(client);
-    return NULL;
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [-q max_queued_bytes] [-p drop|disconnect] [-d name=path]...\n"
+            "          [-s max_sessions] [-l lobby_size] [-c max_clients] [-r hz] [-t threads]\n"
+            "          [-m admin_port] [-R results] [-v]\n"
+            "  -q  output queue limit per client (default %d)\n"
+            "  -p  what to do with clients over the limit (default drop)\n"
+            "  -d  load an additional word list, selectable in the handshake\n"
+            "  -s  maximum number of lobbies (default %d)\n"
+            "  -l  players per lobby, 2 to %d (default %d)\n"
+            "  -c  maximum number of clients (default: open files limit)\n"
+            "  -r  scoreboard updates per second, 1 to %d (default %d)\n"
+            "  -t  worker threads, 1 to %d (default: one per CPU)\n"
+            "  -m  port of the statistics endpoint on 127.0.0.1, 0 to disable (default %d)\n"
+            "  -R  results store, as path prefix of its .log and .idx files, \"\" to disable\n"
+            "      (default %s)\n"
+            "  -v  log the debug records too\n",
+            prog, OUTQ_DEFAULT_MAX_BYTES, SESSIONS_MAX, MAX_LOBBY_COUNT, LOBBY_DEFAULT_SIZE,
+            SCOREBOARD_MAX_HZ, SCOREBOARD_DEFAULT_HZ, SHARDS_MAX, ADMIN_PORT, RESULTS_DEFAULT_PREFIX);
 }
 
-int main(void)
+static long parse_positive(const char *prog, const char *arg)
 {
-    srand((unsigned)time(NULL));
+    char *end;
+    long v = strtol(arg, &end, 10);
+    if (v <= 0 || *end != '\0')
+    {
+        usage(prog);
+        exit(EXIT_FAILURE);
+    }
+    return v;
+}
 
-    init_words_g();
-    list_g = create_session_list();
+// every client needs a descriptor, so the soft limit is raised as far
+// as allowed and the clients get all of it but a few, kept for the
+// listener, epoll and the files opened by the server
+#define RESERVED_FDS 32
 
-    int server_fd, client_socket;
+static int clients_fd_limit(void)
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        return 1024 - RESERVED_FDS;
+    if (rl.rlim_cur < rl.rlim_max)
+    {
+        rlim_t cur = rl.rlim_cur;
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            rl.rlim_cur = cur;
+    }
+    if (rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > INT_MAX)
+        return INT_MAX - RESERVED_FDS;
+    if (rl.rlim_cur <= RESERVED_FDS)
+        return 1;
+    return (int)rl.rlim_cur - RESERVED_FDS;
+}
+
+// with SO_REUSEPORT every worker gets a listening socket of its own on
+// the same port, and the kernel spreads the connections among them
+static int open_listener(void)
+{
+    int server_fd;
     struct sockaddr_in address;
     int opt = 1;
-    socklen_t addrlen = sizeof(address);
 
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
         perror("server socket failed");
         exit(EXIT_FAILURE);
     }
 
     setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0)
+    {
+        perror("failed to share the server port");
+        exit(EXIT_FAILURE);
+    }
+#endif
 
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
@@ -533,73 +1523,244 @@ int main(void)
         exit(EXIT_FAILURE);
     }
 
-    if (listen(server_fd, MAX_CLIENTS) < 0)
+    if (listen(server_fd, SOMAXCONN) < 0 || set_nonblocking(server_fd) < 0)
     {
         perror("socket listening failed");
         exit(EXIT_FAILURE);
     }
+    return server_fd;
+}
 
-    printf("Server listening on port %d...\n", SERVER_PORT);
+int main(int argc, char **argv)
+{
+    // the default word list comes first, the other ones
+    // are loaded while parsing the options
+    init_words_g();
 
-    while (1)
+    int max_sessions = SESSIONS_MAX;
+    int lobby_size = LOBBY_DEFAULT_SIZE;
+    int opt_c;
+    while ((opt_c = getopt(argc, argv, "q:p:d:s:l:c:r:t:m:R:vh")) != -1)
     {
-        if ((client_socket = accept(server_fd, (struct sockaddr *)&address, &addrlen)) < 0)
+        switch (opt_c)
         {
-            perror("failed to accept connection");
-            continue;
+        case 'q':
+            outq_limits_g.max_bytes = (size_t)parse_positive(argv[0], optarg);
+            break;
+        case 's':
+        {
+            long v = parse_positive(argv[0], optarg);
+            max_sessions = v > SESSIONS_MAX ? SESSIONS_MAX : (int)v;
+            break;
         }
-
-        pthread_mutex_lock(&client_lock_g);
-        int is_full = (active_clients_g >= MAX_CLIENTS);
-        pthread_mutex_unlock(&client_lock_g);
-
-        if (is_full)
+        case 'l':
         {
-            printf("Server full, rejecting connection\n");
-            const char *msg = "Server is full, try again later\n";
-#ifdef MSG_NOSIGNAL
-            send(client_socket, msg, strlen(msg), MSG_NOSIGNAL);
-#else
-            send(client_socket, msg, strlen(msg), 0);
-#endif
-            close(client_socket);
-            continue;
+            long v = parse_positive(argv[0], optarg);
+            if (v < 2 || v > MAX_LOBBY_COUNT)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            lobby_size = (int)v;
+            break;
         }
-
-        client_t *client = malloc(sizeof(client_t));
-        if (!client)
+        case 'r':
         {
-            perror("failed to malloc client_t");
-            close(client_socket);
-            continue;
+            long v = parse_positive(argv[0], optarg);
+            if (v > SCOREBOARD_MAX_HZ)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            board_interval_ms_g = (int)(1000 / v);
+            break;
+        }
+        case 't':
+        {
+            long v = parse_positive(argv[0], optarg);
+            if (v > SHARDS_MAX)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            nworkers_g = (int)v;
+            break;
+        }
+        case 'm':
+        {
+            char *end;
+            long v = strtol(optarg, &end, 10);
+            if (v < 0 || v > 65535 || *end != '\0')
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            admin_port_g = (int)v;
+            break;
+        }
+        case 'v':
+            log_level_g = LOG_DEBUG;
+            break;
+        case 'R':
+            results_prefix_g = optarg;
+            break;
+        case 'c':
+        {
+            long v = parse_positive(argv[0], optarg);
+            max_clients_g = v > INT_MAX ? INT_MAX : (int)v;
+            break;
         }
+        case 'p':
+            if (strcmp(optarg, "drop") == 0)
+                outq_limits_g.policy = OUTQ_DROP;
+            else if (strcmp(optarg, "disconnect") == 0)
+                outq_limits_g.policy = OUTQ_DISCONNECT;
+            else
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+        {
+            char *eq = strchr(optarg, '=');
+            if (!eq)
+            {
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            *eq = '\0';
+            if (!dict_load(optarg, eq + 1))
+            {
+                fprintf(stderr, "***ERROR: failed to load dictionary %s from %s\n", optarg, eq + 1);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            exit(opt_c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
 
-        client->socket = client_socket;
-        client->uuid[0] = '\0';
-        client->last_activity_ts.tv_sec = 0;
-        client->last_activity_ts.tv_nsec = 0;
+    // from here on the server logs through the writer thread
+    if (log_start(STDOUT_FILENO) < 0)
+        exit(EXIT_FAILURE);
+    if (results_prefix_g[0] && results_open(results_prefix_g) < 0)
+        fprintf(stderr, "warning: results are not kept\n");
 
-        pthread_mutex_lock(&client_lock_g);
-        active_clients_g++;
-        pthread_mutex_unlock(&client_lock_g);
+    int fd_limit = clients_fd_limit();
+    if (max_clients_g == 0)
+        max_clients_g = fd_limit;
+    else if (max_clients_g > fd_limit)
+    {
+        fprintf(stderr, "warning: only %d descriptors available, clients limited to %d\n",
+                fd_limit + RESERVED_FDS, fd_limit);
+        max_clients_g = fd_limit;
+    }
 
-        pthread_t thread_id;
-        if (pthread_create(&thread_id, NULL, handle_client, (void *)client) != 0)
-        {
-            perror("pthread_create failed");
-            close(client_socket);
-            free(client);
+    list_g = create_session_list(max_sessions, lobby_size);
+    if (uuidmap_init(&players_g) < 0)
+    {
+        fprintf(stderr, "***ERROR: failed to initialize the players index!\n");
+        exit(EXIT_FAILURE);
+    }
 
-            pthread_mutex_lock(&client_lock_g);
-            active_clients_g--;
-            pthread_mutex_unlock(&client_lock_g);
-        }
-        else
+    int ncpus = shard_cpus();
+    if (nworkers_g == 0)
+        nworkers_g = ncpus < SHARDS_MAX ? ncpus : SHARDS_MAX;
+    workers_g = aligned_alloc(_Alignof(worker_t), sizeof(worker_t) * (size_t)nworkers_g);
+    if (!workers_g)
+    {
+        perror("***ERROR: memory allocation failed for workers!");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < nworkers_g; i++)
+    {
+        worker_t *w = &workers_g[i];
+        if (shard_init(&w->shard, i) < 0)
+            exit(EXIT_FAILURE);
+        pool_init(&w->client_pool, sizeof(client_t), POOL_DEFAULT_SLAB);
+        w->clients = NULL;
+        w->listener.fd = -1;
+        timer_init(&w->accept_retry, on_accept_retry, w);
+        w->accept_logged_ms = 0;
+
+#ifndef SO_REUSEPORT
+        // a single listener: the other workers only get
+        // the clients that join their lobbies
+        if (i > 0)
+            continue;
+#endif
+        w->listener.fd = open_listener();
+        w->listener.on_event = on_accept;
+        w->listener.on_release = NULL;
+        if (reactor_add(&w->shard.reactor, &w->listener, EPOLLIN | EPOLLET) < 0)
         {
-            pthread_detach(thread_id);
+            perror("failed to register server socket");
+            exit(EXIT_FAILURE);
         }
     }
 
-    close(server_fd);
+    // the admin endpoint has a thread of its own: a results query
+    // reads the log from disk, no game shard must wait for it
+    int admin_fd = -1;
+    if (admin_port_g > 0 && shard_init(&admin_g, SHARD_UNPINNED) == 0)
+    {
+        admin_fd = stats_listen(&admin_g.reactor, admin_port_g, stats_extra, admin_route);
+        if (admin_fd >= 0)
+            log_write(LOG_INFO, -1, NULL, "Statistics on http://127.0.0.1:%d/metrics", admin_port_g);
+        else
+            shard_destroy(&admin_g);
+    }
+    listen_signals(&workers_g[0].shard.reactor);
+
+    log_write(LOG_INFO, -1, NULL, "Server listening on port %d (up to %d clients, %d lobbies of %d, %d workers)",
+              SERVER_PORT, max_clients_g, max_sessions, lobby_size, nworkers_g);
+
+    // the first worker runs on the main thread
+    for (int i = 1; i < nworkers_g; i++)
+        if (shard_start(&workers_g[i].shard) < 0)
+            exit(EXIT_FAILURE);
+    if (admin_fd >= 0 && shard_start(&admin_g) < 0)
+        exit(EXIT_FAILURE);
+    shard_run(&workers_g[0].shard);
+
+    for (int i = 1; i < nworkers_g; i++)
+    {
+        shard_stop(&workers_g[i].shard);
+        shard_join(&workers_g[i].shard);
+    }
+    if (admin_fd >= 0)
+    {
+        shard_stop(&admin_g);
+        shard_join(&admin_g);
+    }
+
+    // empty unless built with LOCKPROF=1
+    evbuf_t *b = evbuf_get();
+    lockprof_report(b);
+    print_buf(b);
+    if (admin_fd >= 0)
+    {
+        close(admin_fd);
+        shard_destroy(&admin_g);
+    }
+    if (signal_g.fd >= 0)
+        close(signal_g.fd);
+    free_session_list(list_g);
+    for (int i = 0; i < nworkers_g; i++)
+    {
+        if (workers_g[i].listener.fd >= 0)
+            close(workers_g[i].listener.fd);
+        shard_destroy(&workers_g[i].shard);
+        pool_destroy(&workers_g[i].client_pool);
+    }
+    free(workers_g);
+    uuidmap_destroy(&players_g);
+    dict_unload_all();
+    results_close();
+    log_stop();
     return 0;
 }
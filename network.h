@@ -6,8 +6,6 @@
 extern "C" {
 #endif
 
-void* handle_client(void *arg);
-void* session_countdown(void *arg);
 
 #ifdef __cplusplus
 }
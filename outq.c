@@ -0,0 +1,241 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "outq.h"
+#include "stats.h"
+
+#define OUTQ_INITIAL_CAP 8
+#define OUTQ_MAX_IOV     64
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+outq_limits_t outq_limits_g = {
+    .max_bytes = OUTQ_DEFAULT_MAX_BYTES,
+    .policy = OUTQ_DROP,
+};
+
+outmsg_t *outmsg_new(const char *data, size_t len)
+{
+    outmsg_t *msg = malloc(sizeof(outmsg_t) + len);
+    if (!msg)
+        return NULL;
+    msg->refs = 1;
+    msg->len = len;
+    memcpy(msg->data, data, len);
+    return msg;
+}
+
+void outmsg_unref(outmsg_t *msg)
+{
+    if (msg && --msg->refs == 0)
+        free(msg);
+}
+
+// the queue depth gauges: the bytes of every queue, the queues holding
+// something, and those by depth, each queue in the bucket of its size
+static int depth_bucket(size_t bytes)
+{
+    static const size_t bounds[] = {1024, 4096, 16384, 65536};
+    int b = 0;
+    while (b < (int)(sizeof(bounds) / sizeof(bounds[0])) && bytes > bounds[b])
+        b++;
+    return STAT_OUTQ_DEPTH_1K + b;
+}
+
+static void set_bytes(outq_t *q, size_t bytes)
+{
+    if (bytes == q->bytes)
+        return;
+    stats_add(STAT_OUTQ_BYTES, (int64_t)bytes - (int64_t)q->bytes);
+    if (q->bytes > 0)
+        stats_add((stat_id_t)depth_bucket(q->bytes), -1);
+    if (bytes > 0)
+        stats_inc((stat_id_t)depth_bucket(bytes));
+    if ((q->bytes > 0) != (bytes > 0))
+        stats_add(STAT_OUTQ_BACKLOGGED, bytes > 0 ? 1 : -1);
+    q->bytes = bytes;
+}
+
+void outq_init(outq_t *q)
+{
+    q->msgs = NULL;
+    q->cap = 0;
+    q->head = 0;
+    q->count = 0;
+    q->head_off = 0;
+    q->bytes = 0;
+    q->broken = 0;
+    q->peak_bytes = 0;
+    q->sent_bytes = 0;
+    q->sent_msgs = 0;
+    q->dropped_msgs = 0;
+}
+
+// releases the queued messages, the counters are kept
+void outq_clear(outq_t *q)
+{
+    set_bytes(q, 0);
+    for (size_t i = 0; i < q->count; i++)
+        outmsg_unref(q->msgs[(q->head + i) % q->cap]);
+    free(q->msgs);
+    q->msgs = NULL;
+    q->cap = 0;
+    q->head = 0;
+    q->count = 0;
+    q->head_off = 0;
+}
+
+static int outq_push(outq_t *q, outmsg_t *msg, size_t offset)
+{
+    if (q->count == q->cap)
+    {
+        size_t cap = q->cap ? q->cap * 2 : OUTQ_INITIAL_CAP;
+        outmsg_t **msgs = malloc(cap * sizeof(outmsg_t *));
+        if (!msgs)
+            return -1;
+        for (size_t i = 0; i < q->count; i++)
+            msgs[i] = q->msgs[(q->head + i) % q->cap];
+        free(q->msgs);
+        q->msgs = msgs;
+        q->cap = cap;
+        q->head = 0;
+    }
+
+    msg->refs++;
+    q->msgs[(q->head + q->count) % q->cap] = msg;
+    if (q->count == 0)
+        q->head_off = offset;
+    q->count++;
+    set_bytes(q, q->bytes + msg->len - offset);
+    if (q->bytes > q->peak_bytes)
+        q->peak_bytes = q->bytes;
+    return 0;
+}
+
+static void outq_fail(outq_t *q)
+{
+    outq_clear(q);
+    q->broken = 1;
+}
+
+// sends data on the connection, or queues it behind the data that is
+// already waiting. *shared is the message holding the same bytes for the
+// other recipients of a broadcast: it is created on first need and must be
+// released by the caller with outmsg_unref. Returns one of the OUTQ_ codes
+int outq_send(outq_t *q, int fd, const char *data, size_t len, outmsg_t **shared, int droppable)
+{
+    if (q->broken)
+        return OUTQ_ERROR;
+
+    size_t sent = 0;
+    if (q->count == 0)
+    {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            outq_fail(q);
+            return OUTQ_ERROR;
+        }
+        sent = n > 0 ? (size_t)n : 0;
+        q->sent_bytes += sent;
+        stats_add(STAT_BYTES_OUT, (int64_t)sent);
+        if (sent == len)
+        {
+            q->sent_msgs++;
+            stats_inc(STAT_EVENTS_SENT);
+            return OUTQ_OK;
+        }
+    }
+
+    // a line that already started to leave can't be dropped, it would
+    // corrupt the stream, so the limit only applies to untouched ones
+    if (sent == 0 && q->bytes + len > outq_limits_g.max_bytes)
+    {
+        if (droppable && outq_limits_g.policy == OUTQ_DROP)
+        {
+            q->dropped_msgs++;
+            stats_inc(STAT_EVENTS_DROPPED);
+            return OUTQ_DROPPED;
+        }
+        outq_fail(q);
+        return OUTQ_OVERFLOW;
+    }
+
+    if (!*shared)
+        *shared = outmsg_new(data, len);
+    if (!*shared || outq_push(q, *shared, sent) < 0)
+    {
+        outq_fail(q);
+        return OUTQ_ERROR;
+    }
+
+    // the socket is full: the queue will be flushed
+    // by the next writable notification of the reactor
+    return OUTQ_OK;
+}
+
+// writes as much queued data as the socket accepts, with one sendmsg
+// per round covering up to OUTQ_MAX_IOV messages
+int outq_flush(outq_t *q, int fd)
+{
+    if (q->broken)
+        return -1;
+
+    while (q->count > 0)
+    {
+        struct iovec iov[OUTQ_MAX_IOV];
+        size_t n_iov = q->count < OUTQ_MAX_IOV ? q->count : OUTQ_MAX_IOV;
+        for (size_t i = 0; i < n_iov; i++)
+        {
+            outmsg_t *msg = q->msgs[(q->head + i) % q->cap];
+            size_t off = i == 0 ? q->head_off : 0;
+            iov[i].iov_base = msg->data + off;
+            iov[i].iov_len = msg->len - off;
+        }
+
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n_iov;
+
+        ssize_t n = sendmsg(fd, &mh, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            outq_fail(q);
+            return -1;
+        }
+
+        size_t left = (size_t)n;
+        set_bytes(q, q->bytes - left);
+        q->sent_bytes += left;
+        stats_add(STAT_BYTES_OUT, n);
+        while (left > 0)
+        {
+            outmsg_t *msg = q->msgs[q->head];
+            size_t rest = msg->len - q->head_off;
+            if (left < rest)
+            {
+                q->head_off += left;
+                break;
+            }
+            left -= rest;
+            q->sent_msgs++;
+            stats_inc(STAT_EVENTS_SENT);
+            outmsg_unref(msg);
+            q->head = (q->head + 1) % q->cap;
+            q->count--;
+            q->head_off = 0;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stddef.h>
+
+#define OUTQ_DEFAULT_MAX_BYTES (64 * 1024)
+
+// what happens to a client whose queue would grow past max_bytes:
+// with OUTQ_DROP droppable events (progress updates) are discarded
+// and only essential ones disconnect it, with OUTQ_DISCONNECT any
+// event does
+typedef enum outq_policy_e
+{
+    OUTQ_DROP,
+    OUTQ_DISCONNECT
+} outq_policy_t;
+
+typedef struct outq_limits_s
+{
+    size_t max_bytes;
+    outq_policy_t policy;
+} outq_limits_t;
+
+extern outq_limits_t outq_limits_g;
+
+// results of outq_send
+#define OUTQ_OK        0
+#define OUTQ_DROPPED   1
+#define OUTQ_ERROR    -1 // the socket failed
+#define OUTQ_OVERFLOW -2 // the client is too slow and has to be disconnected
+
+// an encoded event shared by every connection it is queued on
+typedef struct outmsg_s
+{
+    int refs;
+    size_t len;
+    char data[];
+} outmsg_t;
+
+// per-connection output queue. Data is written straight to the socket
+// while the queue is empty; whatever the kernel doesn't take is queued,
+// referencing the shared message, and flushed with a single vectored
+// send as soon as the socket becomes writable again
+typedef struct outq_s
+{
+    outmsg_t **msgs; // ring of queued messages
+    size_t cap;
+    size_t head;
+    size_t count;
+    size_t head_off; // bytes of the first message already sent
+    size_t bytes;    // bytes still to be sent
+    int broken;      // the socket failed, everything is discarded
+
+    // counters
+    size_t peak_bytes;
+    unsigned long sent_bytes;
+    unsigned long sent_msgs;
+    unsigned long dropped_msgs;
+} outq_t;
+
+outmsg_t *outmsg_new(const char *data, size_t len);
+void outmsg_unref(outmsg_t *msg);
+
+void outq_init(outq_t *q);
+void outq_clear(outq_t *q);
+int outq_send(outq_t *q, int fd, const char *data, size_t len, outmsg_t **shared, int droppable);
+int outq_flush(outq_t *q, int fd);
+
+static inline int outq_empty(const outq_t *q)
+{
+    return q->count == 0;
+}
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdalign.h>
+#include "pool.h"
+
+// the slab header is padded so that the objects keep the strictest alignment
+#define SLAB_HEADER ((sizeof(void *) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+void pool_init(pool_t *pool, size_t obj_size, int per_slab)
+{
+    size_t align = alignof(max_align_t);
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    pool->obj_size = (obj_size + align - 1) & ~(align - 1);
+    pool->per_slab = per_slab > 0 ? per_slab : POOL_DEFAULT_SLAB;
+    pool->free_list = NULL;
+    pool->slabs = NULL;
+    pool->total = 0;
+    pool->in_use = 0;
+}
+
+void pool_destroy(pool_t *pool)
+{
+    void *slab = pool->slabs;
+    while (slab)
+    {
+        void *next = *(void **)slab;
+        free(slab);
+        slab = next;
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->total = 0;
+    pool->in_use = 0;
+}
+
+static int pool_grow(pool_t *pool)
+{
+    char *slab = malloc(SLAB_HEADER + pool->obj_size * (size_t)pool->per_slab);
+    if (!slab)
+        return -1;
+    *(void **)slab = pool->slabs;
+    pool->slabs = slab;
+
+    // pushed backwards so that the objects come out in address order
+    char *objs = slab + SLAB_HEADER;
+    for (int i = pool->per_slab - 1; i >= 0; i--)
+    {
+        void *obj = objs + pool->obj_size * (size_t)i;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+    pool->total += (size_t)pool->per_slab;
+    return 0;
+}
+
+void *pool_get(pool_t *pool)
+{
+    if (!pool->free_list && pool_grow(pool) < 0)
+        return NULL;
+    void *obj = pool->free_list;
+    pool->free_list = *(void **)obj;
+    pool->in_use++;
+    return obj;
+}
+
+void pool_put(pool_t *pool, void *obj)
+{
+    if (!obj)
+        return;
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->in_use--;
+}
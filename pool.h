@@ -0,0 +1,22 @@
+#pragma once
+#include <stddef.h>
+
+// fixed size object pool. Objects are carved out of slabs that are
+// never given back to the allocator, and released objects are kept in
+// a free list to be handed out again. A pool belongs to a single thread
+#define POOL_DEFAULT_SLAB 64
+
+typedef struct pool_s
+{
+    size_t obj_size;
+    int per_slab;
+    void *free_list;
+    void *slabs;     // linked through the first word of every slab
+    size_t total;    // objects carved so far
+    size_t in_use;
+} pool_t;
+
+void pool_init(pool_t *pool, size_t obj_size, int per_slab);
+void pool_destroy(pool_t *pool);
+void *pool_get(pool_t *pool);
+void pool_put(pool_t *pool, void *obj);
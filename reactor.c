@@ -0,0 +1,117 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "reactor.h"
+
+int reactor_init(reactor_t *reactor)
+{
+    reactor->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (reactor->epfd < 0)
+    {
+        perror("***ERROR: epoll_create1 failed");
+        return -1;
+    }
+    reactor->running = 0;
+    reactor->released = NULL;
+    timer_wheel_init(&reactor->timers);
+    return 0;
+}
+
+void reactor_destroy(reactor_t *reactor)
+{
+    if (reactor->epfd >= 0)
+        close(reactor->epfd);
+    reactor->epfd = -1;
+}
+
+static int reactor_ctl(reactor_t *reactor, int op, reactor_handler_t *handler, uint32_t events)
+{
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = handler;
+    return epoll_ctl(reactor->epfd, op, handler->fd, &ev);
+}
+
+int reactor_add(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    handler->released = 0;
+    handler->next_released = NULL;
+    return reactor_ctl(reactor, EPOLL_CTL_ADD, handler, events);
+}
+
+int reactor_mod(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    return reactor_ctl(reactor, EPOLL_CTL_MOD, handler, events);
+}
+
+// the fd is removed from the epoll set right away, but the handler memory
+// stays valid until the end of the current batch: a later event in the
+// same batch can still point to it and will simply be skipped
+void reactor_release(reactor_t *reactor, reactor_handler_t *handler)
+{
+    if (handler->released)
+        return;
+
+    if (handler->fd >= 0)
+        epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, handler->fd, NULL);
+    handler->released = 1;
+    handler->next_released = reactor->released;
+    reactor->released = handler;
+}
+
+// stops watching the fd but keeps the handler, which can be
+// registered again later or released
+void reactor_del(reactor_t *reactor, reactor_handler_t *handler)
+{
+    if (handler->fd >= 0)
+        epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, handler->fd, NULL);
+}
+
+static void reactor_flush_released(reactor_t *reactor)
+{
+    while (reactor->released)
+    {
+        reactor_handler_t *h = reactor->released;
+        reactor->released = h->next_released;
+        if (h->on_release)
+            h->on_release(h);
+    }
+}
+
+void reactor_run(reactor_t *reactor)
+{
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+
+    reactor->running = 1;
+    while (reactor->running)
+    {
+        // the loop sleeps until an fd is ready or the next timer expires
+        int timeout = timer_wheel_next_timeout(&reactor->timers);
+        int n = epoll_wait(reactor->epfd, events, REACTOR_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("***ERROR: epoll_wait failed");
+            break;
+        }
+
+        timer_wheel_advance(&reactor->timers);
+
+        for (int i = 0; i < n; i++)
+        {
+            reactor_handler_t *h = (reactor_handler_t *)events[i].data.ptr;
+            if (!h->released)
+                h->on_event(reactor, h, events[i].events);
+        }
+        reactor_flush_released(reactor);
+    }
+    reactor_flush_released(reactor);
+}
+
+void reactor_stop(reactor_t *reactor)
+{
+    reactor->running = 0;
+}
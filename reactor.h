@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+#include "timer_wheel.h"
+
+#define REACTOR_MAX_EVENTS 256
+
+typedef struct reactor_s reactor_t;
+typedef struct reactor_handler_s reactor_handler_t;
+
+typedef void (*reactor_cb_t)(reactor_t *reactor, reactor_handler_t *handler, uint32_t events);
+
+// every fd registered in the reactor is described by a handler, usually
+// embedded in a bigger object (e.g. client_t). A handler can be released
+// while events for it are still pending in the current epoll batch, so the
+// memory is given back through on_release only once the batch is over
+struct reactor_handler_s
+{
+    int fd;
+    reactor_cb_t on_event;
+    void (*on_release)(reactor_handler_t *handler);
+
+    int released;
+    reactor_handler_t *next_released;
+};
+
+struct reactor_s
+{
+    int epfd;
+    volatile int running;
+    reactor_handler_t *released;
+    timer_wheel_t timers; // only touched by the reactor thread
+};
+
+int reactor_init(reactor_t *reactor);
+void reactor_destroy(reactor_t *reactor);
+
+int reactor_add(reactor_t *reactor, reactor_handler_t *handler, uint32_t events);
+int reactor_mod(reactor_t *reactor, reactor_handler_t *handler, uint32_t events);
+void reactor_release(reactor_t *reactor, reactor_handler_t *handler);
+void reactor_del(reactor_t *reactor, reactor_handler_t *handler);
+
+void reactor_run(reactor_t *reactor);
+void reactor_stop(reactor_t *reactor);
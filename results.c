@@ -0,0 +1,532 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "results.h"
+#include "mpscq.h"
+#include "lockprof.h"
+#include "log.h"
+
+#define RESULT_MAGIC  0x32527974u // "tyR2"
+#define RESULT_FAMILY 0x00527974u // "tyR", any version
+#define INDEX_MAGIC   0x31497974u // "tyI1"
+#define INDEX_VERSION 2
+#define SCAN_CHUNK    1024 // records read at once when recovering
+
+// the index file: this header, then cap slots (open addressing)
+typedef struct idx_head_s
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t cap;
+    uint32_t count;   // players
+    uint64_t indexed; // log records the slots reflect
+    uint32_t clean;   // closed by results_close, cleared while open
+    uint32_t pad;
+} idx_head_t;
+
+typedef struct idx_slot_s
+{
+    uuid_t uuid;
+    uint32_t last; // newest record of the player
+    uint32_t best; // RESULT_NONE until a race is completed
+    uint32_t count;
+    uint16_t best_wpm;
+    uint16_t used;
+} idx_slot_t;
+
+typedef struct result_item_s
+{
+    mpsc_node_t node;
+    result_rec_t rec;
+} result_item_t;
+
+static struct
+{
+    int open;
+    int log_fd;
+    char idx_path[PATH_MAX];
+    idx_head_t *head; // the whole index is mapped, head first
+    idx_slot_t *slots;
+    size_t map_len;
+    uint32_t nrecs;       // records in the log
+    pthread_mutex_t lock; // the writer updating the index vs the readers
+    mpscq_t queue;
+    atomic_int running;
+    pthread_t writer;
+} store_g = {.log_fd = -1};
+
+static uint32_t checksum(const result_rec_t *rec)
+{
+    const unsigned char *p = (const unsigned char *)rec + offsetof(result_rec_t, uuid);
+    const unsigned char *end = (const unsigned char *)rec + sizeof(*rec);
+    uint32_t h = 2166136261u;
+    for (; p < end; p++)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
+static int rec_valid(const result_rec_t *rec)
+{
+    return rec->magic == RESULT_MAGIC && rec->sum == checksum(rec);
+}
+
+static uint32_t slot_hash(const uuid_t uuid)
+{
+    uint64_t a, b;
+    memcpy(&a, uuid, 8);
+    memcpy(&b, uuid + 8, 8);
+    uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ULL)) * 0xff51afd7ed558ccdULL;
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static idx_slot_t *slot_find(const uuid_t uuid)
+{
+    uint32_t mask = store_g.head->cap - 1;
+    for (uint32_t i = slot_hash(uuid) & mask;; i = (i + 1) & mask)
+    {
+        idx_slot_t *s = &store_g.slots[i];
+        if (!s->used)
+            return NULL;
+        if (uuid_compare(s->uuid, uuid) == 0)
+            return s;
+    }
+}
+
+// ------------------------------------------------------------------
+// index file
+
+static int idx_map(const char *path, uint32_t cap, int create, idx_head_t **head, size_t *len)
+{
+    int fd = open(path, O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (fd < 0)
+        return -1;
+
+    *len = sizeof(idx_head_t) + (size_t)cap * sizeof(idx_slot_t);
+    if (create && ftruncate(fd, (off_t)*len) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, *len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    *head = map;
+    if (create)
+    {
+        (*head)->magic = INDEX_MAGIC;
+        (*head)->version = INDEX_VERSION;
+        (*head)->cap = cap;
+    }
+    return 0;
+}
+
+static void idx_use(idx_head_t *head, size_t len)
+{
+    store_g.head = head;
+    store_g.slots = (idx_slot_t *)(head + 1);
+    store_g.map_len = len;
+}
+
+// the bigger table is filled aside and renamed over the old one,
+// so the file on disk is always one or the other
+static int idx_grow(void)
+{
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", store_g.idx_path);
+
+    idx_head_t *head;
+    size_t len;
+    uint32_t cap = store_g.head->cap * 2;
+    if (idx_map(tmp, cap, 1, &head, &len) < 0)
+        return -1;
+
+    idx_slot_t *slots = (idx_slot_t *)(head + 1);
+    for (uint32_t i = 0; i < store_g.head->cap; i++)
+    {
+        idx_slot_t *s = &store_g.slots[i];
+        if (!s->used)
+            continue;
+        uint32_t j = slot_hash(s->uuid) & (cap - 1);
+        while (slots[j].used)
+            j = (j + 1) & (cap - 1);
+        slots[j] = *s;
+    }
+    head->count = store_g.head->count;
+    head->indexed = store_g.head->indexed;
+
+    if (rename(tmp, store_g.idx_path) < 0)
+    {
+        munmap(head, len);
+        unlink(tmp);
+        return -1;
+    }
+    munmap(store_g.head, store_g.map_len);
+    idx_use(head, len);
+    return 0;
+}
+
+// record number no of the log goes into the index of its player
+static int idx_apply(uint32_t no, const result_rec_t *rec)
+{
+    idx_slot_t *s = slot_find(rec->uuid);
+    if (!s)
+    {
+        if ((store_g.head->count + 1) * 2 > store_g.head->cap && idx_grow() < 0)
+            return -1;
+
+        uint32_t mask = store_g.head->cap - 1;
+        uint32_t i = slot_hash(rec->uuid) & mask;
+        while (store_g.slots[i].used)
+            i = (i + 1) & mask;
+        s = &store_g.slots[i];
+        memcpy(s->uuid, rec->uuid, sizeof(uuid_t));
+        s->best = RESULT_NONE;
+        s->count = 0;
+        s->used = 1;
+        store_g.head->count++;
+    }
+
+    s->last = no;
+    s->count++;
+    if (rec->completed && (s->best == RESULT_NONE || rec->wpm > s->best_wpm))
+    {
+        s->best = no;
+        s->best_wpm = rec->wpm;
+    }
+    store_g.head->indexed = no + 1;
+    return 0;
+}
+
+// ------------------------------------------------------------------
+// recovery
+
+static int read_rec(uint32_t no, result_rec_t *rec)
+{
+    return pread(store_g.log_fd, rec, sizeof(*rec), (off_t)no * (off_t)sizeof(*rec)) == (ssize_t)sizeof(*rec);
+}
+
+// the log ends at the first record that is not whole: what follows
+// is the tail of a commit cut by a crash, and it is dropped
+static int recover_log(void)
+{
+    static result_rec_t chunk[SCAN_CHUNK];
+    uint32_t n = 0;
+
+    for (;;)
+    {
+        ssize_t r = pread(store_g.log_fd, chunk, sizeof(chunk), (off_t)n * (off_t)sizeof(result_rec_t));
+        if (r < 0)
+            return -1;
+        size_t whole = (size_t)r / sizeof(result_rec_t);
+        // a log written with another record layout is not a torn tail,
+        // it is left alone and the store not used
+        if (n == 0 && r >= 4 && chunk[0].magic != RESULT_MAGIC && (chunk[0].magic & 0x00ffffffu) == RESULT_FAMILY)
+        {
+            fprintf(stderr, "***ERROR: the results log was written by another version\n");
+            errno = EINVAL;
+            return -1;
+        }
+        size_t i = 0;
+        while (i < whole && rec_valid(&chunk[i]))
+            i++;
+        n += (uint32_t)i;
+        if (i < SCAN_CHUNK)
+            break;
+    }
+
+    struct stat st;
+    if (fstat(store_g.log_fd, &st) < 0)
+        return -1;
+    off_t end = (off_t)n * (off_t)sizeof(result_rec_t);
+    if (st.st_size != end)
+    {
+        log_write(LOG_WARN, -1, NULL, "results: dropping %lld bytes of torn records", (long long)(st.st_size - end));
+        if (ftruncate(store_g.log_fd, end) < 0)
+            return -1;
+    }
+    store_g.nrecs = n;
+    return 0;
+}
+
+static int idx_usable(const idx_head_t *head, size_t len)
+{
+    return head->magic == INDEX_MAGIC && head->version == INDEX_VERSION && head->cap >= RESULTS_INDEX_INITIAL &&
+           (head->cap & (head->cap - 1)) == 0 &&
+           len == sizeof(idx_head_t) + (size_t)head->cap * sizeof(idx_slot_t) && head->clean &&
+           head->indexed == store_g.nrecs;
+}
+
+// the index is trusted only if it was closed cleanly over this very
+// log, otherwise it is built again from the records
+static int open_index(void)
+{
+    int fd = open(store_g.idx_path, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat st;
+        idx_head_t head;
+        int ok = fstat(fd, &st) == 0 && pread(fd, &head, sizeof(head), 0) == (ssize_t)sizeof(head) &&
+                 idx_usable(&head, (size_t)st.st_size);
+        close(fd);
+
+        idx_head_t *map;
+        size_t len;
+        if (ok && idx_map(store_g.idx_path, head.cap, 0, &map, &len) == 0)
+        {
+            idx_use(map, len);
+            return 0;
+        }
+    }
+
+    log_write(LOG_INFO, -1, NULL, "results: rebuilding the index from %u records", store_g.nrecs);
+    idx_head_t *map;
+    size_t len;
+    if (idx_map(store_g.idx_path, RESULTS_INDEX_INITIAL, 1, &map, &len) < 0)
+        return -1;
+    idx_use(map, len);
+
+    result_rec_t rec;
+    for (uint32_t no = 0; no < store_g.nrecs; no++)
+        if (!read_rec(no, &rec) || idx_apply(no, &rec) < 0)
+            return -1;
+    return 0;
+}
+
+// ------------------------------------------------------------------
+// writer
+
+// group commit: everything queued goes out with one write and one
+// fdatasync, and only then enters the index, so a reader never
+// follows a link to a record that isn't on disk
+static size_t commit(void)
+{
+    static result_rec_t recs[RESULTS_BATCH_MAX];
+    size_t n = 0;
+    mpsc_node_t *node;
+    while (n < RESULTS_BATCH_MAX && (node = mpscq_pop(&store_g.queue)))
+    {
+        result_item_t *item = (result_item_t *)((char *)node - offsetof(result_item_t, node));
+        recs[n++] = item->rec;
+        free(item);
+    }
+    if (n == 0)
+        return 0;
+
+    // only the writer changes the index, it can read it unlocked
+    for (size_t i = 0; i < n; i++)
+    {
+        result_rec_t *rec = &recs[i];
+        rec->prev = RESULT_NONE;
+        for (size_t j = i; j-- > 0;)
+        {
+            if (uuid_compare(recs[j].uuid, rec->uuid) == 0)
+            {
+                rec->prev = store_g.nrecs + (uint32_t)j;
+                break;
+            }
+        }
+        if (rec->prev == RESULT_NONE)
+        {
+            idx_slot_t *s = slot_find(rec->uuid);
+            if (s)
+                rec->prev = s->last;
+        }
+        rec->magic = RESULT_MAGIC;
+        rec->sum = checksum(rec);
+    }
+
+    off_t at = (off_t)store_g.nrecs * (off_t)sizeof(result_rec_t);
+    size_t len = n * sizeof(result_rec_t);
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t w = pwrite(store_g.log_fd, (char *)recs + done, len - done, at + (off_t)done);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            break;
+        done += (size_t)w;
+    }
+    if (done < len || fdatasync(store_g.log_fd) < 0)
+    {
+        log_write(LOG_ERROR, -1, NULL, "results: failed to commit %zu results: %s", n, strerror(errno));
+        if (ftruncate(store_g.log_fd, at) < 0)
+            log_write(LOG_ERROR, -1, NULL, "results: failed to cut the log: %s", strerror(errno));
+        return n;
+    }
+
+    lock_take(&store_g.lock, LOCK_RESULTS);
+    for (size_t i = 0; i < n; i++)
+        if (idx_apply(store_g.nrecs + (uint32_t)i, &recs[i]) < 0)
+            log_write(LOG_ERROR, -1, NULL, "results: failed to grow the index");
+    store_g.nrecs += (uint32_t)n;
+    lock_drop(&store_g.lock);
+    return n;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    for (;;)
+    {
+        int stopping = !atomic_load(&store_g.running);
+        if (commit() > 0)
+            continue;
+        if (stopping)
+            break;
+
+        struct timespec pause = {0, RESULTS_COMMIT_MS * 1000000L};
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+int results_open(const char *prefix)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s.log", prefix);
+    snprintf(store_g.idx_path, sizeof(store_g.idx_path), "%s.idx", prefix);
+
+    store_g.log_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (store_g.log_fd < 0 || recover_log() < 0 || open_index() < 0)
+    {
+        fprintf(stderr, "***ERROR: results store %s unusable: %s\n", prefix, strerror(errno));
+        if (store_g.head)
+            munmap(store_g.head, store_g.map_len);
+        if (store_g.log_fd >= 0)
+            close(store_g.log_fd);
+        store_g.head = NULL;
+        store_g.log_fd = -1;
+        return -1;
+    }
+
+    // from now on the index on disk may run ahead of the log
+    store_g.head->clean = 0;
+    msync(store_g.head, sizeof(idx_head_t), MS_SYNC);
+
+    pthread_mutex_init(&store_g.lock, NULL);
+    mpscq_init(&store_g.queue);
+    atomic_store(&store_g.running, 1);
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int err = pthread_create(&store_g.writer, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0)
+    {
+        fprintf(stderr, "***ERROR: failed to start the results writer: %s\n", strerror(err));
+        return -1;
+    }
+    store_g.open = 1;
+    log_write(LOG_INFO, -1, NULL, "results: %u races of %u players in %s", store_g.nrecs, store_g.head->count, path);
+    return 0;
+}
+
+void results_close(void)
+{
+    if (!store_g.open)
+        return;
+    store_g.open = 0;
+    atomic_store(&store_g.running, 0);
+    pthread_join(store_g.writer, NULL);
+
+    store_g.head->clean = 1;
+    msync(store_g.head, store_g.map_len, MS_SYNC);
+    munmap(store_g.head, store_g.map_len);
+    close(store_g.log_fd);
+    store_g.head = NULL;
+    store_g.log_fd = -1;
+    pthread_mutex_destroy(&store_g.lock);
+}
+
+void results_add(const result_rec_t *rec)
+{
+    if (!store_g.open)
+        return;
+    result_item_t *item = malloc(sizeof(*item));
+    if (!item)
+    {
+        log_write(LOG_ERROR, -1, rec->uuid, "results: no memory, result lost");
+        return;
+    }
+    item->rec = *rec;
+    mpscq_push(&store_g.queue, &item->node);
+}
+
+// ------------------------------------------------------------------
+// queries
+
+// what the index says about a player, copied under the lock: the
+// records it leads to are already on disk and never change, so they
+// are read afterwards without holding up the writer
+static void slot_snapshot(const uuid_t uuid, idx_slot_t *out)
+{
+    lock_take(&store_g.lock, LOCK_RESULTS);
+    idx_slot_t *s = slot_find(uuid);
+    if (s)
+        *out = *s;
+    lock_drop(&store_g.lock);
+}
+
+static void render_rec(evbuf_t *b, const char *key, const result_rec_t *rec)
+{
+    ev_obj_open(b, key);
+    ev_strn(b, "name", rec->name, strnlen(rec->name, sizeof(rec->name)));
+    ev_int(b, "finished_ms", (long)rec->finished_ms);
+    ev_int(b, "duration_ms", (long)rec->duration_ms);
+    ev_int(b, "words", rec->words);
+    ev_int(b, "wpm", rec->wpm);
+    ev_int(b, "raw_wpm", rec->raw_wpm);
+    ev_int(b, "accuracy", rec->accuracy);
+    ev_int(b, "completed", rec->completed);
+    // a uint64 doesn't survive a JSON number, the seed goes as hex
+    char seed[17];
+    snprintf(seed, sizeof(seed), "%016llx", (unsigned long long)rec->seed);
+    ev_str(b, "seed", seed);
+    ev_strn(b, "dict", rec->dict, strnlen(rec->dict, sizeof(rec->dict)));
+    ev_obj_close(b);
+}
+
+void results_render(evbuf_t *b, const uuid_t uuid)
+{
+    idx_slot_t slot = {.last = RESULT_NONE, .best = RESULT_NONE};
+    if (store_g.open)
+        slot_snapshot(uuid, &slot);
+
+    result_rec_t best;
+    int has_best = slot.best != RESULT_NONE && read_rec(slot.best, &best);
+    result_rec_t history[RESULTS_HISTORY_MAX];
+    int n = 0;
+    for (uint32_t no = slot.last; no != RESULT_NONE && n < RESULTS_HISTORY_MAX; no = history[n++].prev)
+        if (!read_rec(no, &history[n]))
+            break;
+
+    char text[37];
+    uuid_unparse_lower(uuid, text);
+    ev_obj_open(b, NULL);
+    ev_str(b, "uuid", text);
+    ev_int(b, "races", (long)slot.count);
+    if (has_best)
+        render_rec(b, "best", &best);
+    ev_arr_open(b, "history");
+    for (int i = 0; i < n; i++)
+        render_rec(b, NULL, &history[i]);
+    ev_arr_close(b);
+    ev_obj_close(b);
+    ev_bytes(b, "\n", 1);
+}
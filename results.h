@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+#include <uuid/uuid.h>
+#include "event.h"
+#include "dict.h"
+
+// race results, kept across restarts. Results are appended to a log of
+// fixed-size records by a writer thread, which commits whatever arrived
+// since its previous round with a single write and one fdatasync. A
+// memory-mapped hash table indexes the log by player: its last result
+// (every record links to the previous one of the same player), how many
+// it has and its best one. The index can always be rebuilt from the log:
+// on startup a torn tail of the log is cut, and an index that wasn't
+// closed cleanly is built again
+#define RESULTS_DEFAULT_PREFIX "typeL-results" // .log and .idx
+#define RESULTS_COMMIT_MS      50
+#define RESULTS_BATCH_MAX      256
+#define RESULTS_INDEX_INITIAL  1024 // slots, a power of two
+#define RESULTS_HISTORY_MAX    20   // results listed by the admin endpoint
+#define RESULT_NONE            UINT32_MAX
+
+typedef struct result_rec_s
+{
+    uint32_t magic;       // RESULT_MAGIC, set on every written record
+    uint32_t sum;         // FNV-1a of the bytes that follow, a torn write fails it
+    uuid_t uuid;
+    int64_t finished_ms;  // unix time
+    uint64_t seed;        // with dict, generate_words gives back the words of the race
+    uint32_t prev;        // previous record of the same player, RESULT_NONE for the first
+    uint32_t duration_ms; // from the start of the game
+    uint16_t words;       // correct ones
+    uint16_t wpm;
+    uint16_t raw_wpm;
+    uint8_t accuracy;
+    uint8_t completed;    // all the words, otherwise cut by the end of the session
+    char name[16];        // not NUL terminated when 16 chars long
+    char dict[DICT_NAME_LEN];
+    uint8_t reserved[8];
+} result_rec_t;
+
+_Static_assert(sizeof(result_rec_t) == 96, "results are 96 byte records");
+
+// recovers the store and starts the writer. Returns -1 if the files
+// can't be used: the server then runs without keeping results
+int results_open(const char *prefix);
+// commits what is still pending and closes the index cleanly
+void results_close(void);
+
+// from any thread: the record is copied and queued for the writer,
+// the fields filled by the store (magic, sum, prev) are ignored
+void results_add(const result_rec_t *rec);
+
+// { "uuid", "races", "best", "history": [...] } for the admin endpoint:
+// the count, the best result and the last RESULTS_HISTORY_MAX ones, newest
+// first, as of a single point in time. It reads the log, so it blocks on
+// the disk and must not run on a game thread
+void results_render(evbuf_t *b, const uuid_t uuid);
@@ -0,0 +1,85 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "rng.h"
+
+static _Thread_local rng_t rng_tls;
+static _Thread_local int rng_tls_ready = 0;
+
+static uint64_t splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k)
+{
+    return (x << k) | (x >> (64 - k));
+}
+
+// the four words of state are expanded from the seed
+// with splitmix64, so they are never all zero
+void rng_seed(rng_t *rng, uint64_t seed)
+{
+    for (int i = 0; i < 4; i++)
+        rng->s[i] = splitmix64(&seed);
+}
+
+uint64_t rng_next(rng_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+// uniform number in [0, n), with Lemire's multiply-and-reject
+// method instead of a biased modulo
+uint32_t rng_range(rng_t *rng, uint32_t n)
+{
+    uint64_t m = (uint64_t)(uint32_t)(rng_next(rng) >> 32) * n;
+    uint32_t low = (uint32_t)m;
+    if (low < n)
+    {
+        uint32_t threshold = (uint32_t)(-n) % n;
+        while (low < threshold)
+        {
+            m = (uint64_t)(uint32_t)(rng_next(rng) >> 32) * n;
+            low = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+// the state of the calling thread, seeded on first use from the
+// kernel entropy pool (or the clock, if that is not available)
+rng_t *rng_thread(void)
+{
+    if (!rng_tls_ready)
+    {
+        uint64_t seed = 0;
+        FILE *f = fopen("/dev/urandom", "rb");
+        if (!f || fread(&seed, sizeof(seed), 1, f) != 1)
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            seed = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+            seed ^= (uint64_t)(uintptr_t)&rng_tls;
+        }
+        if (f)
+            fclose(f);
+        rng_seed(&rng_tls, seed);
+        rng_tls_ready = 1;
+    }
+    return &rng_tls;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdint.h>
+
+// xoshiro256** generator. Every thread has its own state (rng_thread), so
+// drawing numbers never takes a lock; a state can also be seeded explicitly
+// to replay the exact same sequence
+typedef struct rng_s
+{
+    uint64_t s[4];
+} rng_t;
+
+void rng_seed(rng_t *rng, uint64_t seed);
+uint64_t rng_next(rng_t *rng);
+uint32_t rng_range(rng_t *rng, uint32_t n);
+rng_t *rng_thread(void);
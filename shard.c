@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "shard.h"
+
+static cpu_set_t allowed_g; // filled by shard_cpus, before any shard starts
+static int allowed_count_g = 0;
+
+int shard_cpus(void)
+{
+    CPU_ZERO(&allowed_g);
+    if (sched_getaffinity(0, sizeof(allowed_g), &allowed_g) < 0)
+        return 1;
+    allowed_count_g = CPU_COUNT(&allowed_g);
+    return allowed_count_g > 0 ? allowed_count_g : 1;
+}
+
+// every shard stays on its own CPU, so that the clients and lobbies it
+// runs stay in that CPU caches. Failing to pin is not an error
+static void pin_to_cpu(int id)
+{
+    if (allowed_count_g == 0 || id == SHARD_UNPINNED)
+        return;
+
+    int nth = id % allowed_count_g;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (!CPU_ISSET(cpu, &allowed_g) || nth-- > 0)
+            continue;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        return;
+    }
+}
+
+// the flag is cleared before draining, so a message posted from here on
+// writes the eventfd again; one still being pushed is not seen yet, but
+// its producer writes the eventfd once done
+static void on_wake(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    (void)reactor;
+    (void)events;
+    shard_t *shard = (shard_t *)((char *)handler - offsetof(shard_t, wake));
+
+    uint64_t n;
+    while (read(handler->fd, &n, sizeof(n)) < 0 && errno == EINTR)
+        ;
+    atomic_store(&shard->wake_pending, 0);
+
+    mpsc_node_t *node;
+    while ((node = mpscq_pop(&shard->inbox)))
+    {
+        shard_msg_t *msg = (shard_msg_t *)((char *)node - offsetof(shard_msg_t, node));
+        msg->run(shard, msg);
+    }
+}
+
+int shard_init(shard_t *shard, int id)
+{
+    shard->id = id;
+    mpscq_init(&shard->inbox);
+    atomic_init(&shard->wake_pending, 0);
+    if (reactor_init(&shard->reactor) < 0)
+        return -1;
+
+    shard->wake.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    shard->wake.on_event = on_wake;
+    shard->wake.on_release = NULL;
+    if (shard->wake.fd < 0 || reactor_add(&shard->reactor, &shard->wake, EPOLLIN | EPOLLET) < 0)
+    {
+        perror("***ERROR: failed to set up the shard inbox");
+        if (shard->wake.fd >= 0)
+            close(shard->wake.fd);
+        reactor_destroy(&shard->reactor);
+        return -1;
+    }
+    return 0;
+}
+
+void shard_destroy(shard_t *shard)
+{
+    if (shard->wake.fd >= 0)
+        close(shard->wake.fd);
+    shard->wake.fd = -1;
+    reactor_destroy(&shard->reactor);
+}
+
+// the eventfd is written only by the first post since the last wake up
+void shard_post(shard_t *shard, shard_msg_t *msg)
+{
+    mpscq_push(&shard->inbox, &msg->node);
+    if (atomic_exchange(&shard->wake_pending, 1))
+        return;
+
+    uint64_t one = 1;
+    while (write(shard->wake.fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+void shard_run(shard_t *shard)
+{
+    pin_to_cpu(shard->id);
+    reactor_run(&shard->reactor);
+}
+
+static void *shard_main(void *arg)
+{
+    shard_run((shard_t *)arg);
+    return NULL;
+}
+
+int shard_start(shard_t *shard)
+{
+    int err = pthread_create(&shard->thread, NULL, shard_main, shard);
+    if (err != 0)
+    {
+        fprintf(stderr, "***ERROR: failed to start shard %d: %s\n", shard->id, strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+void shard_stop(shard_t *shard)
+{
+    reactor_stop(&shard->reactor);
+
+    uint64_t one = 1;
+    while (write(shard->wake.fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+void shard_join(shard_t *shard)
+{
+    pthread_join(shard->thread, NULL);
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <pthread.h>
+#include <stdatomic.h>
+#include "reactor.h"
+#include "mpscq.h"
+
+#define SHARDS_MAX     64
+#define SHARD_UNPINNED -1 // the id of a shard that isn't a worker, it runs on any CPU
+
+typedef struct shard_s shard_t;
+typedef struct shard_msg_s shard_msg_t;
+
+// work handed to a shard by another thread, usually embedded in the
+// object being handed over: run is called by the shard thread
+struct shard_msg_s
+{
+    mpsc_node_t node;
+    void (*run)(shard_t *shard, shard_msg_t *msg);
+};
+
+// a worker event loop, with its own reactor and timer wheel. What a
+// shard owns is only touched by its thread: the other threads can only
+// post messages to its inbox, which wakes it up through an eventfd
+struct shard_s
+{
+    int id;
+    reactor_t reactor;
+    mpscq_t inbox;
+    _Alignas(64) atomic_int wake_pending; // the eventfd was already written
+    reactor_handler_t wake;
+    pthread_t thread;
+};
+
+int shard_init(shard_t *shard, int id);
+void shard_destroy(shard_t *shard);
+
+// can be called from any thread
+void shard_post(shard_t *shard, shard_msg_t *msg);
+
+// the loop runs in a new thread, or in the calling one
+int shard_start(shard_t *shard);
+void shard_run(shard_t *shard);
+void shard_stop(shard_t *shard);
+void shard_join(shard_t *shard);
+
+// CPUs the process is allowed to run on, one shard each by default
+int shard_cpus(void);
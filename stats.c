@@ -0,0 +1,353 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "stats.h"
+
+#define ADMIN_REQ_MAX        2048
+#define ADMIN_TIMEOUT_MS     5000 // a whole request/response exchange
+#define ADMIN_ACCEPT_RETRY_MS 100 // out of descriptors, try again
+
+_Thread_local stats_slot_t *stats_tls = NULL;
+
+static stats_slot_t slots_g[STATS_SLOTS_MAX];
+static atomic_int nslots_g = 0;
+
+// threads beyond the last slot share it: their updates can be lost, but
+// the server never runs that many
+stats_slot_t *stats_attach(void)
+{
+    int i = atomic_fetch_add(&nslots_g, 1);
+    stats_tls = &slots_g[i < STATS_SLOTS_MAX ? i : STATS_SLOTS_MAX - 1];
+    return stats_tls;
+}
+
+int64_t stats_total(stat_id_t id)
+{
+    int n = atomic_load(&nslots_g);
+    if (n > STATS_SLOTS_MAX)
+        n = STATS_SLOTS_MAX;
+
+    int64_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += atomic_load_explicit(&slots_g[i].v[id], memory_order_relaxed);
+    return total;
+}
+
+// the ids of a family (same name, different labels) are adjacent
+static const struct
+{
+    const char *name;
+    const char *labels;
+    const char *type;
+    const char *help;
+} stat_info[STAT_COUNT] = {
+    [STAT_ACCEPTED] = {"typel_connections_accepted_total", NULL, "counter", "Connections accepted."},
+    [STAT_REJECTED] = {"typel_connections_rejected_total", NULL, "counter",
+                       "Connections refused because the server was full."},
+    [STAT_HANDOFFS] = {"typel_handoffs_total", NULL, "counter",
+                       "Clients moved to the worker running their lobby."},
+    [STAT_WORDS_CORRECT] = {"typel_words_total", "result=\"correct\"", "counter", "Words submitted."},
+    [STAT_WORDS_WRONG] = {"typel_words_total", "result=\"wrong\"", "counter", "Words submitted."},
+    [STAT_EVENTS_SENT] = {"typel_events_sent_total", NULL, "counter", "Events written to the clients."},
+    [STAT_EVENTS_DROPPED] = {"typel_events_dropped_total", NULL, "counter",
+                             "Droppable events skipped for slow clients."},
+    [STAT_BYTES_IN] = {"typel_bytes_received_total", NULL, "counter", "Bytes read from the clients."},
+    [STAT_BYTES_OUT] = {"typel_bytes_sent_total", NULL, "counter", "Bytes written to the clients."},
+    [STAT_KICK_INACTIVE] = {"typel_kicks_total", "reason=\"inactive\"", "counter", "Clients kicked."},
+    [STAT_KICK_SLOW] = {"typel_kicks_total", "reason=\"slow_consumer\"", "counter", "Clients kicked."},
+    [STAT_KICK_COMPLETED] = {"typel_kicks_total", "reason=\"completed\"", "counter", "Clients kicked."},
+    [STAT_KICK_SESSION_END] = {"typel_kicks_total", "reason=\"session_end\"", "counter", "Clients kicked."},
+    [STAT_KICK_NOT_BACK] = {"typel_kicks_total", "reason=\"not_back\"", "counter", "Clients kicked."},
+    [STAT_KICK_BAD_INPUT] = {"typel_kicks_total", "reason=\"bad_input\"", "counter", "Clients kicked."},
+    [STAT_LOG_DROPPED] = {"typel_log_dropped_total", NULL, "counter", "Log records dropped on a full ring."},
+    [STAT_LOBBIES_COUNTDOWN] = {"typel_lobbies", "state=\"countdown\"", "gauge", "Lobbies by state."},
+    [STAT_LOBBIES_PLAYING] = {"typel_lobbies", "state=\"playing\"", "gauge", "Lobbies by state."},
+    [STAT_OUTQ_BYTES] = {"typel_outq_bytes", NULL, "gauge", "Bytes queued for the clients."},
+    [STAT_OUTQ_BACKLOGGED] = {"typel_outq_backlogged_clients", NULL, "gauge",
+                              "Clients with events waiting in their output queue."},
+    [STAT_OUTQ_DEPTH_1K] = {"typel_outq_clients", "depth=\"1KiB\"", "gauge",
+                            "Clients with a backlog, by bytes queued."},
+    [STAT_OUTQ_DEPTH_4K] = {"typel_outq_clients", "depth=\"4KiB\"", "gauge",
+                            "Clients with a backlog, by bytes queued."},
+    [STAT_OUTQ_DEPTH_16K] = {"typel_outq_clients", "depth=\"16KiB\"", "gauge",
+                             "Clients with a backlog, by bytes queued."},
+    [STAT_OUTQ_DEPTH_64K] = {"typel_outq_clients", "depth=\"64KiB\"", "gauge",
+                             "Clients with a backlog, by bytes queued."},
+    [STAT_OUTQ_DEPTH_MORE] = {"typel_outq_clients", "depth=\"more\"", "gauge",
+                              "Clients with a backlog, by bytes queued."},
+};
+
+void stats_gauge(evbuf_t *b, const char *name, const char *help, int64_t value)
+{
+    ev_printf(b, "# HELP %s %s\n# TYPE %s gauge\n%s %lld\n", name, help, name, name, (long long)value);
+}
+
+void stats_render(evbuf_t *b, stats_extra_t extra)
+{
+    for (int i = 0; i < STAT_COUNT; i++)
+    {
+        if (i == 0 || strcmp(stat_info[i].name, stat_info[i - 1].name) != 0)
+            ev_printf(b, "# HELP %s %s\n# TYPE %s %s\n", stat_info[i].name, stat_info[i].help,
+                      stat_info[i].name, stat_info[i].type);
+
+        long long v = (long long)stats_total((stat_id_t)i);
+        if (stat_info[i].labels)
+            ev_printf(b, "%s{%s} %lld\n", stat_info[i].name, stat_info[i].labels, v);
+        else
+            ev_printf(b, "%s %lld\n", stat_info[i].name, v);
+    }
+    if (extra)
+        extra(b);
+}
+
+// ------------------------------------------------------------------
+// admin endpoint: a bare HTTP/1.0 server, one request per connection
+
+typedef struct admin_conn_s
+{
+    reactor_handler_t handler;
+    reactor_t *reactor;
+    tw_timer_t timeout;
+    char req[ADMIN_REQ_MAX];
+    size_t req_len;
+    char *resp;
+    size_t resp_len;
+    size_t resp_off;
+} admin_conn_t;
+
+static reactor_handler_t admin_listener_g;
+static reactor_t *admin_reactor_g = NULL;
+static tw_timer_t admin_retry_g;
+static stats_extra_t admin_extra_g = NULL;
+static stats_route_t admin_route_g = NULL;
+
+static void on_admin_release(reactor_handler_t *handler)
+{
+    admin_conn_t *conn = (admin_conn_t *)((char *)handler - offsetof(admin_conn_t, handler));
+    free(conn->resp);
+    free(conn);
+}
+
+static void admin_close(reactor_t *reactor, admin_conn_t *conn)
+{
+    timer_cancel(&conn->timeout);
+    reactor_release(reactor, &conn->handler);
+    close(conn->handler.fd);
+    conn->handler.fd = -1;
+}
+
+// a connection that doesn't send its request (or read the response)
+// in time would hold its descriptor forever
+static void on_admin_timeout(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    admin_conn_t *conn = (admin_conn_t *)arg;
+    admin_close(conn->reactor, conn);
+}
+
+static int request_done(const admin_conn_t *conn)
+{
+    return memmem(conn->req, conn->req_len, "\r\n\r\n", 4) || memmem(conn->req, conn->req_len, "\n\n", 2);
+}
+
+// only GET, the path ends at the first space or at the end of the line
+static int request_path(const admin_conn_t *conn, const char **path, size_t *len)
+{
+    if (conn->req_len < 5 || memcmp(conn->req, "GET /", 5) != 0)
+        return 0;
+    *path = conn->req + 4;
+    *len = 0;
+    while (4 + *len < conn->req_len && !strchr(" \r\n", (*path)[*len]))
+        (*len)++;
+    return 1;
+}
+
+static int build_response(admin_conn_t *conn)
+{
+    const char *status = "404 Not Found";
+    const char *type = "text/plain";
+    evbuf_t *b = evbuf_get();
+    const char *path;
+    size_t len;
+    int get = request_path(conn, &path, &len);
+    if (get && len == 8 && memcmp(path, "/metrics", 8) == 0)
+    {
+        status = "200 OK";
+        type = "text/plain; version=0.0.4";
+        stats_render(b, admin_extra_g);
+    }
+    else if (get && admin_route_g && (type = admin_route_g(path, len, b)))
+        status = "200 OK";
+    else
+    {
+        type = "text/plain";
+        ev_bytes(b, "not found\n", 10);
+    }
+    if (b->oom)
+        return -1;
+
+    char head[160];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.0 %s\r\nContent-Type: %s\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                     status, type, b->len);
+    conn->resp = malloc((size_t)n + b->len);
+    if (!conn->resp)
+        return -1;
+    memcpy(conn->resp, head, (size_t)n);
+    memcpy(conn->resp + n, b->data, b->len);
+    conn->resp_len = (size_t)n + b->len;
+    conn->resp_off = 0;
+    return 0;
+}
+
+static void on_admin_event(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    admin_conn_t *conn = (admin_conn_t *)((char *)handler - offsetof(admin_conn_t, handler));
+    if (events & EPOLLERR)
+    {
+        admin_close(reactor, conn);
+        return;
+    }
+
+    if (!conn->resp)
+    {
+        int eof = 0;
+        while (conn->req_len < sizeof(conn->req))
+        {
+            ssize_t n = recv(handler->fd, conn->req + conn->req_len, sizeof(conn->req) - conn->req_len, 0);
+            if (n > 0)
+                conn->req_len += (size_t)n;
+            else if (n == 0)
+            {
+                eof = 1;
+                break;
+            }
+            else if (errno == EINTR)
+                continue;
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            else
+            {
+                admin_close(reactor, conn);
+                return;
+            }
+        }
+        if (!eof && !request_done(conn) && conn->req_len < sizeof(conn->req))
+            return;
+        if (build_response(conn) < 0)
+        {
+            admin_close(reactor, conn);
+            return;
+        }
+    }
+
+    while (conn->resp_off < conn->resp_len)
+    {
+        ssize_t n = send(handler->fd, conn->resp + conn->resp_off, conn->resp_len - conn->resp_off, MSG_NOSIGNAL);
+        if (n > 0)
+            conn->resp_off += (size_t)n;
+        else if (n < 0 && errno == EINTR)
+            continue;
+        else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;
+        else
+            break;
+    }
+    admin_close(reactor, conn);
+}
+
+static void on_admin_accept(reactor_t *reactor, reactor_handler_t *handler, uint32_t events)
+{
+    (void)events;
+    for (;;)
+    {
+        int fd = accept(handler->fd, NULL, NULL);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // the listener is edge triggered: the connections left in the
+            // backlog wouldn't be notified again, so they are picked up
+            // later, when descriptors may have been freed
+            if ((errno == EMFILE || errno == ENFILE) && !timer_pending(&admin_retry_g))
+                timer_add(&reactor->timers, &admin_retry_g, ADMIN_ACCEPT_RETRY_MS);
+            return;
+        }
+
+        admin_conn_t *conn = calloc(1, sizeof(*conn));
+        if (!conn || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0)
+        {
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->handler.fd = fd;
+        conn->handler.on_event = on_admin_event;
+        conn->handler.on_release = on_admin_release;
+        conn->reactor = reactor;
+        timer_init(&conn->timeout, on_admin_timeout, conn);
+        if (reactor_add(reactor, &conn->handler, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET) < 0)
+        {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        timer_add(&reactor->timers, &conn->timeout, ADMIN_TIMEOUT_MS);
+    }
+}
+
+static void on_admin_retry(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    (void)arg;
+    on_admin_accept(admin_reactor_g, &admin_listener_g, EPOLLIN);
+}
+
+int stats_listen(reactor_t *reactor, int port, stats_extra_t extra, stats_route_t route)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("***ERROR: admin socket");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+    {
+        perror("***ERROR: admin bind");
+        close(fd);
+        return -1;
+    }
+
+    admin_extra_g = extra;
+    admin_route_g = route;
+    admin_reactor_g = reactor;
+    timer_init(&admin_retry_g, on_admin_retry, NULL);
+    admin_listener_g.fd = fd;
+    admin_listener_g.on_event = on_admin_accept;
+    admin_listener_g.on_release = NULL;
+    if (reactor_add(reactor, &admin_listener_g, EPOLLIN | EPOLLET) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
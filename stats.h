@@ -0,0 +1,81 @@
+#pragma once
+#include <stdint.h>
+#include <stdatomic.h>
+#include "event.h"
+#include "reactor.h"
+
+// server statistics. Every thread counts into its own slot, claimed on
+// its first update, so counting is a plain load and store on a cache
+// line no other thread writes. The admin endpoint adds the slots up
+// when scraped, the totals are only as fresh as the relaxed loads
+#define STATS_SLOTS_MAX 128
+#define ADMIN_PORT      9001
+
+typedef enum stat_id_e
+{
+    STAT_ACCEPTED,
+    STAT_REJECTED,
+    STAT_HANDOFFS,       // clients moved to the shard of their lobby
+    STAT_WORDS_CORRECT,
+    STAT_WORDS_WRONG,
+    STAT_EVENTS_SENT,
+    STAT_EVENTS_DROPPED, // droppable events skipped for slow clients
+    STAT_BYTES_IN,
+    STAT_BYTES_OUT,
+    STAT_KICK_INACTIVE,
+    STAT_KICK_SLOW,
+    STAT_KICK_COMPLETED, // grace period after the last word is over
+    STAT_KICK_SESSION_END,
+    STAT_KICK_NOT_BACK,  // parked and never reconnected
+    STAT_KICK_BAD_INPUT,
+    STAT_LOG_DROPPED,    // log records that didn't fit in the ring
+    // gauges: a slot holds the changes made by its thread, so on
+    // its own it may even be negative
+    STAT_LOBBIES_COUNTDOWN,
+    STAT_LOBBIES_PLAYING,
+    STAT_OUTQ_BYTES,      // queued for the clients, not yet taken by the kernel
+    STAT_OUTQ_BACKLOGGED, // clients with something queued
+    STAT_OUTQ_DEPTH_1K,   // the same clients by queued bytes, up to 1 KiB
+    STAT_OUTQ_DEPTH_4K,
+    STAT_OUTQ_DEPTH_16K,
+    STAT_OUTQ_DEPTH_64K,
+    STAT_OUTQ_DEPTH_MORE,
+    STAT_COUNT
+} stat_id_t;
+
+typedef struct stats_slot_s
+{
+    _Alignas(64) _Atomic int64_t v[STAT_COUNT];
+} stats_slot_t;
+
+extern _Thread_local stats_slot_t *stats_tls;
+stats_slot_t *stats_attach(void);
+
+// only the owner thread writes its slot, so no atomic add is needed
+static inline void stats_add(stat_id_t id, int64_t n)
+{
+    stats_slot_t *s = stats_tls ? stats_tls : stats_attach();
+    atomic_store_explicit(&s->v[id], atomic_load_explicit(&s->v[id], memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline void stats_inc(stat_id_t id)
+{
+    stats_add(id, 1);
+}
+
+int64_t stats_total(stat_id_t id);
+
+// Prometheus text format. extra appends the gauges the caller keeps
+// elsewhere, with stats_gauge
+typedef void (*stats_extra_t)(evbuf_t *b);
+void stats_render(evbuf_t *b, stats_extra_t extra);
+void stats_gauge(evbuf_t *b, const char *name, const char *help, int64_t value);
+
+// the other paths of the endpoint: route fills b and returns its
+// content type, or NULL when it doesn't know the path
+typedef const char *(*stats_route_t)(const char *path, size_t len, evbuf_t *b);
+
+// serves the statistics over HTTP on 127.0.0.1:port, from the reactor
+// of the calling thread. Returns the listening fd, -1 on failure
+int stats_listen(reactor_t *reactor, int port, stats_extra_t extra, stats_route_t route);
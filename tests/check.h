@@ -0,0 +1,35 @@
+#pragma once
+#include <stdio.h>
+
+// the checks of the unit tests: a failed one is reported and the test
+// goes on, the exit status tells whether any failed
+static int check_failed_g = 0;
+
+#define CHECK(cond)                                                       \
+    do                                                                    \
+    {                                                                     \
+        if (!(cond))                                                      \
+        {                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,       \
+                    __LINE__, #cond);                                     \
+            check_failed_g++;                                             \
+        }                                                                 \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                    \
+    do                                                                    \
+    {                                                                     \
+        long long a_ = (long long)(a), b_ = (long long)(b);               \
+        if (a_ != b_)                                                     \
+        {                                                                 \
+            fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n",     \
+                    __FILE__, __LINE__, #a, #b, a_, b_);                  \
+            check_failed_g++;                                             \
+        }                                                                 \
+    } while (0)
+
+static inline int check_done(const char *name)
+{
+    printf("%s: %s\n", name, check_failed_g ? "FAILED" : "ok");
+    return check_failed_g ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cjson/cJSON.h>
+#include "results.h"
+#include "check.h"
+
+#define PLAYERS 600 // more than fit in the initial index
+
+static char prefix_g[64];
+static char log_path_g[80];
+static char idx_path_g[80];
+
+static void player_uuid(int i, uuid_t uuid)
+{
+    memset(uuid, 0, sizeof(uuid_t));
+    uuid[0] = 0x42;
+    uuid[14] = (unsigned char)(i >> 8);
+    uuid[15] = (unsigned char)i;
+}
+
+// player i runs i % 3 + 1 races, the completed ones at 40, 41, ... wpm,
+// and the last one is cut by the end of the session
+static int races_of(int i)
+{
+    return i % 3 + 1;
+}
+
+static void add_races(void)
+{
+    for (int r = 0; r < 3; r++)
+    {
+        for (int i = 0; i < PLAYERS; i++)
+        {
+            if (r >= races_of(i))
+                continue;
+            result_rec_t rec;
+            memset(&rec, 0, sizeof(rec));
+            player_uuid(i, rec.uuid);
+            rec.finished_ms = 1000 * r;
+            rec.seed = (uint64_t)i << 8 | (uint64_t)r;
+            rec.completed = r + 1 < races_of(i) || races_of(i) == 1;
+            rec.wpm = (uint16_t)(rec.completed ? 40 + r : 90);
+            rec.words = (uint16_t)r;
+            snprintf(rec.name, sizeof(rec.name), "p%d", i);
+            strcpy(rec.dict, "en");
+            results_add(&rec);
+        }
+    }
+}
+
+static cJSON *render(int i)
+{
+    uuid_t uuid;
+    player_uuid(i, uuid);
+    evbuf_t *b = evbuf_get();
+    results_render(b, uuid);
+    return cJSON_ParseWithLength(b->data, b->len);
+}
+
+static int int_of(const cJSON *obj, const char *key)
+{
+    const cJSON *v = cJSON_GetObjectItemCaseSensitive(obj, key);
+    return cJSON_IsNumber(v) ? v->valueint : -1;
+}
+
+// what the store tells about every player, whichever way the index was built
+static void check_players(void)
+{
+    for (int i = 0; i < PLAYERS; i++)
+    {
+        cJSON *root = render(i);
+        CHECK(root != NULL);
+        if (!root)
+            continue;
+        int n = races_of(i);
+        CHECK_EQ(int_of(root, "races"), n);
+
+        // the best completed race: the one before the last, or the only one
+        const cJSON *best = cJSON_GetObjectItemCaseSensitive(root, "best");
+        CHECK_EQ(int_of(best, "wpm"), n == 1 ? 40 : 40 + n - 2);
+
+        // newest first, linked back through every race
+        const cJSON *history = cJSON_GetObjectItemCaseSensitive(root, "history");
+        CHECK_EQ(cJSON_GetArraySize(history), n);
+        int r = n;
+        const cJSON *rec;
+        cJSON_ArrayForEach(rec, history)
+        {
+            r--;
+            CHECK_EQ(int_of(rec, "words"), r);
+            char name[16];
+            snprintf(name, sizeof(name), "p%d", i);
+            const cJSON *v = cJSON_GetObjectItemCaseSensitive(rec, "name");
+            CHECK(cJSON_IsString(v) && strcmp(v->valuestring, name) == 0);
+        }
+        cJSON_Delete(root);
+    }
+}
+
+static long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+static void append(const char *path, const void *data, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_APPEND);
+    CHECK(fd >= 0);
+    CHECK_EQ(write(fd, data, len), len);
+    close(fd);
+}
+
+static void test_reopen(void)
+{
+    CHECK_EQ(results_open(prefix_g), 0);
+    add_races();
+    results_close();
+    CHECK_EQ(file_size(log_path_g), (long)(PLAYERS * 2 * sizeof(result_rec_t)));
+
+    // closed cleanly, the index is used as it is
+    CHECK_EQ(results_open(prefix_g), 0);
+    check_players();
+    results_close();
+}
+
+// a crash in the middle of a commit: half a record, and a whole one
+// that never got its checksum right
+static void test_torn_tail(void)
+{
+    long size = file_size(log_path_g);
+    result_rec_t rec;
+    memset(&rec, 0xab, sizeof(rec));
+    append(log_path_g, &rec, sizeof(rec));
+    append(log_path_g, &rec, sizeof(rec) / 2);
+
+    CHECK_EQ(results_open(prefix_g), 0);
+    CHECK_EQ(file_size(log_path_g), size);
+    check_players();
+    results_close();
+}
+
+// an index that wasn't closed, or that is gone, is built again
+static void test_rebuild(void)
+{
+    int fd = open(idx_path_g, O_RDWR);
+    CHECK(fd >= 0);
+    uint32_t zero = 0;
+    CHECK_EQ(pwrite(fd, &zero, sizeof(zero), 24), sizeof(zero)); // the clean flag
+    close(fd);
+    CHECK_EQ(results_open(prefix_g), 0);
+    check_players();
+    results_close();
+
+    CHECK_EQ(unlink(idx_path_g), 0);
+    CHECK_EQ(results_open(prefix_g), 0);
+    check_players();
+    results_close();
+}
+
+// a log with records of another layout is not mistaken for a torn one
+static void test_other_version(void)
+{
+    int fd = open(log_path_g, O_WRONLY | O_TRUNC);
+    CHECK(fd >= 0);
+    static const char old[96] = "tyR1";
+    CHECK_EQ(write(fd, old, sizeof(old)), sizeof(old));
+    close(fd);
+
+    CHECK_EQ(results_open(prefix_g), -1);
+    CHECK_EQ(file_size(log_path_g), 96);
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/typeL-test-XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    snprintf(prefix_g, sizeof(prefix_g), "%s/results", dir);
+    snprintf(log_path_g, sizeof(log_path_g), "%s.log", prefix_g);
+    snprintf(idx_path_g, sizeof(idx_path_g), "%s.idx", prefix_g);
+
+    test_reopen();
+    test_torn_tail();
+    test_rebuild();
+    test_other_version();
+
+    unlink(log_path_g);
+    unlink(idx_path_g);
+    rmdir(dir);
+    return check_done("results");
+}
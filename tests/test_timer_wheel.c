@@ -0,0 +1,217 @@
+#include <stdint.h>
+#include "timer_wheel.h"
+#include "check.h"
+
+#define TICK TIMER_WHEEL_TICK_MS
+
+// the wheel reads the clock itself: moving its origin back is the same
+// as letting the time pass, without waiting for it. The origin follows
+// the clock too, so that only the test time counts
+static uint64_t virt_g; // ms elapsed in the test
+
+static void elapse(timer_wheel_t *w, uint64_t ms)
+{
+    virt_g += ms;
+    w->origin_ms = monotonic_ms() - virt_g;
+    timer_wheel_advance(w);
+}
+
+typedef struct probe_s
+{
+    tw_timer_t timer;
+    uint64_t delay;
+    uint64_t fired_at;
+    int fired;
+} probe_t;
+
+static uint64_t last_fired_g; // expiry tick of the last one
+static int out_of_order_g;
+
+static void on_probe(tw_timer_t *timer, void *arg)
+{
+    probe_t *p = (probe_t *)arg;
+    p->fired++;
+    p->fired_at = virt_g;
+    if (timer->expires < last_fired_g)
+        out_of_order_g++;
+    last_fired_g = timer->expires;
+}
+
+static void start(timer_wheel_t *w)
+{
+    timer_wheel_init(w);
+    virt_g = 0;
+    last_fired_g = 0;
+    out_of_order_g = 0;
+}
+
+// deadlines on every level, around the bounds where they cascade
+static const uint64_t delays[] = {
+    0, 5, 10, 630, 640, 650, 5000, 40950, 40960, 41000, 655350, 655360, 2621440, 3000000,
+};
+#define NDELAYS (int)(sizeof(delays) / sizeof(delays[0]))
+
+static void test_cascade(void)
+{
+    timer_wheel_t w;
+    probe_t p[NDELAYS];
+    start(&w);
+    for (int i = 0; i < NDELAYS; i++)
+    {
+        p[i].delay = delays[i];
+        p[i].fired = 0;
+        timer_init(&p[i].timer, on_probe, &p[i]);
+        timer_add(&w, &p[i].timer, delays[i]);
+    }
+    CHECK_EQ(w.count, NDELAYS);
+
+    // a tick at a time, every cascade happens on its own
+    while (virt_g < delays[NDELAYS - 1] + 10 * TICK)
+        elapse(&w, TICK);
+
+    for (int i = 0; i < NDELAYS; i++)
+    {
+        CHECK_EQ(p[i].fired, 1);
+        CHECK(p[i].fired_at >= p[i].delay);
+        CHECK(p[i].fired_at <= p[i].delay + 2 * TICK);
+        CHECK(!timer_pending(&p[i].timer));
+    }
+    CHECK_EQ(out_of_order_g, 0);
+    CHECK_EQ(w.count, 0);
+    CHECK_EQ(timer_wheel_next_timeout(&w), -1);
+}
+
+// a late advance runs every expired timer at once, still in order
+static void test_jump(void)
+{
+    timer_wheel_t w;
+    probe_t p[NDELAYS];
+    start(&w);
+    for (int i = NDELAYS - 1; i >= 0; i--)
+    {
+        p[i].delay = delays[i];
+        p[i].fired = 0;
+        timer_init(&p[i].timer, on_probe, &p[i]);
+        timer_add(&w, &p[i].timer, delays[i]);
+    }
+
+    elapse(&w, 50000);
+    int pending = 0;
+    for (int i = 0; i < NDELAYS; i++)
+    {
+        CHECK_EQ(p[i].fired, delays[i] <= 50000 ? 1 : 0);
+        pending += timer_pending(&p[i].timer);
+    }
+    CHECK_EQ(out_of_order_g, 0);
+    CHECK_EQ(w.count, pending);
+
+    elapse(&w, 3000000);
+    for (int i = 0; i < NDELAYS; i++)
+        CHECK_EQ(p[i].fired, 1);
+    CHECK_EQ(w.count, 0);
+}
+
+// re-arming moves a pending timer, cancelling takes it out
+static void test_rearm_cancel(void)
+{
+    timer_wheel_t w;
+    probe_t a = {.delay = 100}, b = {.delay = 0};
+    start(&w);
+    timer_init(&a.timer, on_probe, &a);
+    timer_init(&b.timer, on_probe, &b);
+
+    timer_add(&w, &a.timer, 100000);
+    timer_add(&w, &a.timer, 100);
+    timer_add(&w, &b.timer, 50);
+    CHECK_EQ(w.count, 2);
+    timer_cancel(&b.timer);
+    timer_cancel(&b.timer);
+    CHECK_EQ(w.count, 1);
+
+    for (int i = 0; i < 20000; i++)
+        elapse(&w, TICK);
+    CHECK_EQ(a.fired, 1);
+    CHECK(a.fired_at >= 100 && a.fired_at <= 100 + 2 * TICK);
+    CHECK_EQ(b.fired, 0);
+    CHECK_EQ(w.count, 0);
+}
+
+// the callbacks may arm and cancel any timer, the ones expiring in the
+// same tick included
+static timer_wheel_t *wheel_g;
+static tw_timer_t *victim_g;
+static int periodic_runs_g;
+
+static void on_cancel_other(tw_timer_t *timer, void *arg)
+{
+    (void)timer;
+    (void)arg;
+    timer_cancel(victim_g);
+}
+
+static void on_periodic(tw_timer_t *timer, void *arg)
+{
+    (void)arg;
+    if (++periodic_runs_g < 5)
+        timer_add(wheel_g, timer, 1000);
+}
+
+static void test_callbacks(void)
+{
+    timer_wheel_t w;
+    tw_timer_t killer, periodic;
+    probe_t victim = {.delay = 0};
+    start(&w);
+    wheel_g = &w;
+    victim_g = &victim.timer;
+    periodic_runs_g = 0;
+
+    timer_init(&killer, on_cancel_other, NULL);
+    timer_init(&victim.timer, on_probe, &victim);
+    timer_init(&periodic, on_periodic, NULL);
+    timer_add(&w, &killer, 200);
+    timer_add(&w, &victim.timer, 200);
+    timer_add(&w, &periodic, 1000);
+
+    while (virt_g < 10000)
+        elapse(&w, TICK);
+    CHECK_EQ(victim.fired, 0);
+    CHECK_EQ(periodic_runs_g, 5);
+    CHECK(!timer_pending(&periodic));
+    CHECK_EQ(w.count, 0);
+}
+
+static void test_next_timeout(void)
+{
+    timer_wheel_t w;
+    tw_timer_t t;
+    start(&w);
+    timer_init(&t, NULL, NULL);
+    CHECK_EQ(timer_wheel_next_timeout(&w), -1);
+
+    timer_add(&w, &t, 50);
+    int ms = timer_wheel_next_timeout(&w);
+    CHECK(ms > 0 && ms <= 50 + TICK);
+
+    // on an upper level, the wheel wakes up at the latest when it wraps
+    timer_add(&w, &t, 5000);
+    ms = timer_wheel_next_timeout(&w);
+    CHECK(ms > 0 && ms <= TW_SLOTS * TICK);
+
+    // past the last level the deadline is cut to the farthest one
+    timer_add(&w, &t, UINT64_C(1) << 40);
+    CHECK(timer_pending(&t));
+    CHECK_EQ(t.expires, ((UINT64_C(1) << (TW_BITS * TW_LEVELS)) - 1) + w.tick);
+    timer_cancel(&t);
+    CHECK_EQ(timer_wheel_next_timeout(&w), -1);
+}
+
+int main(void)
+{
+    test_cascade();
+    test_jump();
+    test_rearm_cancel();
+    test_callbacks();
+    test_next_timeout();
+    return check_done("timer_wheel");
+}
@@ -0,0 +1,251 @@
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "wire.h"
+#include "linebuf.h"
+#include "check.h"
+
+static const uint64_t varints[] = {
+    0, 1, 127, 128, 300, 16383, 16384, UINT64_C(1) << 32, UINT64_MAX,
+};
+static const size_t varint_sizes[] = {1, 1, 1, 2, 2, 2, 3, 5, 10};
+#define NVARINTS (int)(sizeof(varints) / sizeof(varints[0]))
+
+static void test_varint(void)
+{
+    for (int i = 0; i < NVARINTS; i++)
+    {
+        evbuf_t *b = evbuf_get_bin();
+        ev_varint(b, varints[i]);
+        CHECK_EQ(b->len, varint_sizes[i]);
+
+        const unsigned char *p = (const unsigned char *)b->data, *end = p + b->len;
+        uint64_t v = 0;
+        CHECK(wire_get_varint(&p, end, &v));
+        CHECK(v == varints[i]);
+        CHECK(p == end);
+
+        // one byte short, the value is not complete
+        p = (const unsigned char *)b->data;
+        CHECK(!wire_get_varint(&p, end - 1, &v));
+    }
+
+    // more continuation bytes than any 64 bits value needs
+    unsigned char endless[12];
+    memset(endless, 0x80, sizeof(endless));
+    const unsigned char *p = endless;
+    uint64_t v;
+    CHECK(!wire_get_varint(&p, endless + sizeof(endless), &v));
+}
+
+static void test_str(void)
+{
+    evbuf_t *b = evbuf_get_bin();
+    ev_varint(b, 5);
+    ev_bytes(b, "hello", 5);
+    ev_varint(b, 0);
+
+    const unsigned char *p = (const unsigned char *)b->data, *end = p + b->len;
+    const char *s;
+    size_t len;
+    CHECK(wire_get_str(&p, end, &s, &len));
+    CHECK(len == 5 && memcmp(s, "hello", 5) == 0);
+    CHECK(wire_get_str(&p, end, &s, &len));
+    CHECK_EQ(len, 0);
+    CHECK(p == end);
+
+    // the announced length runs past the payload
+    p = (const unsigned char *)b->data;
+    CHECK(!wire_get_str(&p, end - 2, &s, &len));
+}
+
+// splits a frame in place: its length must cover exactly the rest
+static int frame_open(const evbuf_t *b, const unsigned char **p, const unsigned char **end, size_t *hdr)
+{
+    const unsigned char *start = (const unsigned char *)b->data;
+    *p = start;
+    *end = start + b->len;
+    uint64_t len;
+    if (!wire_get_varint(p, *end, &len) || len != (uint64_t)(*end - *p))
+        return 0;
+    *hdr = (size_t)(*p - start);
+    return 1;
+}
+
+// the length prefix takes one, two or three bytes, the
+// opcode counting in the length
+static void test_json_frames(void)
+{
+    static char text[20000];
+    static const size_t lens[] = {1, 126, 127, 128, 16382, 16383, 16384, sizeof(text) - 1};
+    static const size_t hdrs[] = {1, 1, 2, 2, 2, 3, 3, 3};
+    for (int i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++)
+    {
+        memset(text, 'a' + i, lens[i]);
+        text[lens[i]] = '\n';
+        evbuf_t json = {.data = text, .len = lens[i] + 1, .cap = sizeof(text)};
+        evbuf_t *b = wire_json(&json);
+        CHECK(!b->oom);
+
+        const unsigned char *p, *end;
+        size_t hdr = 0;
+        CHECK(frame_open(b, &p, &end, &hdr));
+        CHECK_EQ(hdr, hdrs[i]);
+        CHECK_EQ(*p++, WOP_JSON);
+        CHECK_EQ(end - p, lens[i]);
+        CHECK(memcmp(p, text, lens[i]) == 0);
+    }
+}
+
+static void test_words(void)
+{
+    static char arena[] = "alpha\0be\0\0gamma";
+    dict_word_t index[] = {{0, 5}, {6, 2}, {9, 0}, {10, 5}};
+    dict_t dict = {.name = "test", .arena = arena, .index = index, .count = 4};
+    const uint32_t words[] = {3, 0, 2, 1, 3};
+
+    evbuf_t *b = wire_words(&dict, words, 5);
+    const unsigned char *p, *end;
+    size_t hdr;
+    CHECK(frame_open(b, &p, &end, &hdr));
+    CHECK_EQ(*p++, WOP_WORDS);
+    uint64_t count;
+    CHECK(wire_get_varint(&p, end, &count));
+    CHECK_EQ(count, 5);
+    for (int i = 0; i < 5; i++)
+    {
+        const char *s;
+        size_t len;
+        CHECK(wire_get_str(&p, end, &s, &len));
+        CHECK_EQ(len, dict_word_len(&dict, (int)words[i]));
+        CHECK(memcmp(s, dict_word(&dict, (int)words[i]), len) == 0);
+    }
+    CHECK(p == end);
+}
+
+static void test_scoreboard(void)
+{
+    static const unsigned char uuids[2][16] = {{1, 2, 3}, {0xff, 0xee}};
+    event_board_t players[2] = {
+        {.uuid_bin = uuids[0], .mask = BOARD_ALL, .values = {12, 70, 80, 95, 300, 3, 1}},
+        {.uuid_bin = uuids[1], .mask = BOARD_WORDS | BOARD_CHAR, .values = {7, 0, 0, 0, 0, -1, 0}},
+    };
+
+    evbuf_t *b = wire_scoreboard(players, 2);
+    const unsigned char *p, *end;
+    size_t hdr;
+    CHECK(frame_open(b, &p, &end, &hdr));
+    CHECK_EQ(*p++, WOP_SCOREBOARD);
+    uint64_t count;
+    CHECK(wire_get_varint(&p, end, &count));
+    CHECK_EQ(count, 2);
+    for (int i = 0; i < 2; i++)
+    {
+        CHECK(end - p > 17 && memcmp(p, uuids[i], 16) == 0);
+        p += 16;
+        unsigned mask = *p++;
+        CHECK_EQ(mask, players[i].mask);
+        for (int f = 0; f < BOARD_FIELDS; f++)
+        {
+            if (!(mask & (1u << f)))
+                continue;
+            uint64_t v;
+            CHECK(wire_get_varint(&p, end, &v));
+            // negative values go out as 0
+            CHECK_EQ(v, players[i].values[f] > 0 ? players[i].values[f] : 0);
+        }
+    }
+    CHECK(p == end);
+}
+
+static void feed(linebuf_t *lb, int fds[2], const void *data, size_t len)
+{
+    CHECK_EQ(write(fds[1], data, len), len);
+    CHECK_EQ(linebuf_recv(lb, fds[0]), len);
+}
+
+// frames trickling in a byte at a time, then many at once so that the
+// ring wraps and the frames across its end are copied out
+static void test_linebuf_frames(void)
+{
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    linebuf_t lb;
+    linebuf_init(&lb);
+    static char scratch[LINEBUF_SIZE];
+    unsigned char *frame;
+    size_t len;
+
+    static char text[300];
+    memset(text, 'x', sizeof(text));
+    evbuf_t json = {.data = text, .len = sizeof(text), .cap = sizeof(text)};
+    evbuf_t *b = wire_json(&json);
+    for (size_t i = 0; i < b->len; i++)
+    {
+        CHECK_EQ(linebuf_next_frame(&lb, &frame, &len, scratch), 0);
+        feed(&lb, fds, b->data + i, 1);
+    }
+    CHECK_EQ(linebuf_next_frame(&lb, &frame, &len, scratch), 1);
+    CHECK_EQ(len, sizeof(text) + 1);
+    CHECK(frame[0] == WOP_JSON && memcmp(frame + 1, text, sizeof(text)) == 0);
+    CHECK_EQ(lb.len, 0);
+
+    // the first byte of the next frame stays buffered, so that the
+    // ring never gets empty and restarts from the beginning
+    feed(&lb, fds, b->data, 1);
+    int copied = 0;
+    for (int round = 0; round < 20; round++)
+    {
+        text[0] = (char)('a' + round);
+        b = wire_json(&json);
+        feed(&lb, fds, b->data + 1, b->len - 1);
+        feed(&lb, fds, b->data, 1);
+        CHECK_EQ(linebuf_next_frame(&lb, &frame, &len, scratch), 1);
+        CHECK_EQ(len, sizeof(text) + 1);
+        CHECK(frame[0] == WOP_JSON && memcmp(frame + 1, text, sizeof(text)) == 0);
+        copied += frame == (unsigned char *)scratch;
+    }
+    CHECK(copied > 0);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+static int next_frame_of(const unsigned char *data, size_t n)
+{
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    linebuf_t lb;
+    linebuf_init(&lb);
+    static char scratch[LINEBUF_SIZE];
+    unsigned char *frame;
+    size_t len;
+    feed(&lb, fds, data, n);
+    close(fds[0]);
+    close(fds[1]);
+    return linebuf_next_frame(&lb, &frame, &len, scratch);
+}
+
+static void test_linebuf_malformed(void)
+{
+    static const unsigned char empty[] = {0x00, WOP_DISCONNECT};
+    static const unsigned char long_prefix[] = {0x80, 0x80, 0x80, 0x01};
+    static const unsigned char too_big[] = {0x81, 0x10, WOP_WORD}; // 2049 bytes
+    static const unsigned char partial[] = {0x05, WOP_WORD, 0x00};
+    CHECK_EQ(next_frame_of(empty, sizeof(empty)), -1);
+    CHECK_EQ(next_frame_of(long_prefix, sizeof(long_prefix)), -1);
+    CHECK_EQ(next_frame_of(too_big, sizeof(too_big)), -1);
+    CHECK_EQ(next_frame_of(partial, sizeof(partial)), 0);
+}
+
+int main(void)
+{
+    test_varint();
+    test_str();
+    test_json_frames();
+    test_words();
+    test_scoreboard();
+    test_linebuf_frames();
+    test_linebuf_malformed();
+    return check_done("wire");
+}
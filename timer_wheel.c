@@ -0,0 +1,199 @@
+#define _POSIX_C_SOURCE 200809L
+#include <time.h>
+#include <stddef.h>
+#include "timer_wheel.h"
+
+uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void list_init(tw_timer_t *head)
+{
+    head->prev = head->next = head;
+}
+
+static int list_empty(const tw_timer_t *head)
+{
+    return head->next == head;
+}
+
+static void list_append(tw_timer_t *head, tw_timer_t *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(tw_timer_t *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+}
+
+// moves every node of src to the (empty) list dst
+static void list_move(tw_timer_t *src, tw_timer_t *dst)
+{
+    list_init(dst);
+    if (list_empty(src))
+        return;
+    dst->next = src->next;
+    dst->prev = src->prev;
+    dst->next->prev = dst;
+    dst->prev->next = dst;
+    list_init(src);
+}
+
+void timer_wheel_init(timer_wheel_t *wheel)
+{
+    wheel->origin_ms = monotonic_ms();
+    wheel->now_ms = wheel->origin_ms;
+    wheel->tick = 0;
+    wheel->count = 0;
+    for (int l = 0; l < TW_LEVELS; l++)
+        for (int s = 0; s < TW_SLOTS; s++)
+            list_init(&wheel->slots[l][s]);
+}
+
+// the level is chosen by how far in the future the timer expires,
+// the slot by the bits of the expiry tick belonging to that level
+static void wheel_place(timer_wheel_t *wheel, tw_timer_t *timer)
+{
+    uint64_t diff = timer->expires - wheel->tick;
+    const uint64_t max = ((uint64_t)1 << (TW_BITS * TW_LEVELS)) - 1;
+    if (timer->expires < wheel->tick)
+        diff = 0, timer->expires = wheel->tick;
+    if (diff > max)
+        diff = max, timer->expires = wheel->tick + max;
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && diff >= ((uint64_t)1 << (TW_BITS * (level + 1))))
+        level++;
+
+    int slot = (int)((timer->expires >> (TW_BITS * level)) & TW_MASK);
+    list_append(&wheel->slots[level][slot], timer);
+}
+
+void timer_init(tw_timer_t *timer, tw_callback_t callback, void *arg)
+{
+    timer->prev = timer->next = NULL;
+    timer->wheel = NULL;
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+// (re)arms the timer: a pending timer is moved to its new deadline
+void timer_add(timer_wheel_t *wheel, tw_timer_t *timer, uint64_t delay_ms)
+{
+    timer_cancel(timer);
+
+    uint64_t at = wheel->now_ms - wheel->origin_ms + delay_ms;
+    timer->expires = (at + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    timer->wheel = wheel;
+    wheel->count++;
+    wheel_place(wheel, timer);
+}
+
+void timer_cancel(tw_timer_t *timer)
+{
+    if (!timer->wheel)
+        return;
+    list_unlink(timer);
+    timer->wheel->count--;
+    timer->wheel = NULL;
+}
+
+// re-distributes the timers of a slot of an upper level into the lower
+// ones. Returns the slot index, which is 0 when the upper level wrapped too
+static int cascade(timer_wheel_t *wheel, int level)
+{
+    int slot = (int)((wheel->tick >> (TW_BITS * level)) & TW_MASK);
+    tw_timer_t pending;
+    list_move(&wheel->slots[level][slot], &pending);
+    while (!list_empty(&pending))
+    {
+        tw_timer_t *t = pending.next;
+        list_unlink(t);
+        wheel_place(wheel, t);
+    }
+    return slot;
+}
+
+static void run_tick(timer_wheel_t *wheel)
+{
+    int slot = (int)(wheel->tick & TW_MASK);
+    if (slot == 0)
+    {
+        for (int level = 1; level < TW_LEVELS; level++)
+            if (cascade(wheel, level) != 0)
+                break;
+    }
+
+    // the slot is detached and the tick moved forward before running the
+    // callbacks, since they are free to arm or cancel any timer, including
+    // the ones in this slot
+    tw_timer_t expired;
+    list_move(&wheel->slots[0][slot], &expired);
+    wheel->tick++;
+    while (!list_empty(&expired))
+    {
+        tw_timer_t *t = expired.next;
+        list_unlink(t);
+        t->wheel = NULL;
+        wheel->count--;
+        t->callback(t, t->arg);
+    }
+}
+
+// runs every timer expired up to now
+void timer_wheel_advance(timer_wheel_t *wheel)
+{
+    wheel->now_ms = monotonic_ms();
+    uint64_t target = (wheel->now_ms - wheel->origin_ms) / TIMER_WHEEL_TICK_MS;
+
+    // nothing to fire, the wheel can jump straight to the current tick
+    if (wheel->count == 0)
+    {
+        if (wheel->tick <= target)
+            wheel->tick = target + 1;
+        return;
+    }
+
+    while (wheel->tick <= target)
+        run_tick(wheel);
+}
+
+// milliseconds until the wheel needs to be advanced again, -1 when there
+// are no timers. Only the first level is scanned: when it is empty the
+// wheel has to wake up at its next wrap anyway, to cascade the upper levels
+int timer_wheel_next_timeout(const timer_wheel_t *wheel)
+{
+    if (wheel->count == 0)
+        return -1;
+
+    uint64_t ticks = TW_SLOTS - (wheel->tick & TW_MASK);
+    for (uint64_t i = 0; i < TW_SLOTS; i++)
+    {
+        int slot = (int)((wheel->tick + i) & TW_MASK);
+        if (!list_empty(&wheel->slots[0][slot]))
+        {
+            ticks = i;
+            break;
+        }
+        if (slot == TW_MASK)
+        {
+            ticks = i + 1;
+            break;
+        }
+    }
+
+    uint64_t deadline = wheel->origin_ms + (wheel->tick + ticks) * TIMER_WHEEL_TICK_MS;
+    if (deadline <= wheel->now_ms)
+        return 0;
+    return (int)(deadline - wheel->now_ms);
+}
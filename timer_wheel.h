@@ -0,0 +1,51 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// hierarchical timing wheel: TW_LEVELS wheels of TW_SLOTS slots, each level
+// TW_SLOTS times coarser than the previous one. Timers are intrusive list
+// nodes, so arming, re-arming and cancelling are all O(1)
+#define TW_BITS           6
+#define TW_SLOTS          (1 << TW_BITS)
+#define TW_MASK           (TW_SLOTS - 1)
+#define TW_LEVELS         4
+#define TIMER_WHEEL_TICK_MS 10
+
+typedef struct tw_timer_s tw_timer_t;
+typedef struct timer_wheel_s timer_wheel_t;
+
+typedef void (*tw_callback_t)(tw_timer_t *timer, void *arg);
+
+struct tw_timer_s
+{
+    tw_timer_t *prev;
+    tw_timer_t *next;
+    timer_wheel_t *wheel; // set while the timer is pending
+    uint64_t expires;     // in ticks
+    tw_callback_t callback;
+    void *arg;
+};
+
+struct timer_wheel_s
+{
+    uint64_t origin_ms; // monotonic time of tick 0
+    uint64_t now_ms;    // cached at every advance
+    uint64_t tick;      // next tick to be processed
+    int count;
+    tw_timer_t slots[TW_LEVELS][TW_SLOTS];
+};
+
+uint64_t monotonic_ms(void);
+
+void timer_wheel_init(timer_wheel_t *wheel);
+void timer_wheel_advance(timer_wheel_t *wheel);
+int timer_wheel_next_timeout(const timer_wheel_t *wheel);
+
+void timer_init(tw_timer_t *timer, tw_callback_t callback, void *arg);
+void timer_add(timer_wheel_t *wheel, tw_timer_t *timer, uint64_t delay_ms);
+void timer_cancel(tw_timer_t *timer);
+
+static inline int timer_pending(const tw_timer_t *timer)
+{
+    return timer->wheel != NULL;
+}
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <string.h>
+#include "uuidmap.h"
+#include "lockprof.h"
+
+// random uuids would be fine as they are, the mixing is for the
+// time based ones, whose bytes are mostly the same
+static uint64_t uuid_hash(const uuid_t key)
+{
+    uint64_t a, b;
+    memcpy(&a, key, 8);
+    memcpy(&b, key + 8, 8);
+    uint64_t h = a ^ (b * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uuidmap_stripe_t *stripe_of(uuidmap_t *map, uint64_t hash)
+{
+    // the top bits pick the stripe, the low ones the bucket
+    return &map->stripes[(hash >> 60) & (UUIDMAP_STRIPES - 1)];
+}
+
+int uuidmap_init(uuidmap_t *map)
+{
+    for (int i = 0; i < UUIDMAP_STRIPES; i++)
+    {
+        uuidmap_stripe_t *s = &map->stripes[i];
+        s->buckets = calloc(UUIDMAP_INITIAL_BUCKETS, sizeof(uuid_entry_t *));
+        if (!s->buckets || pthread_mutex_init(&s->lock, NULL) != 0)
+        {
+            free(s->buckets);
+            while (--i >= 0)
+            {
+                pthread_mutex_destroy(&map->stripes[i].lock);
+                free(map->stripes[i].buckets);
+            }
+            return -1;
+        }
+        s->mask = UUIDMAP_INITIAL_BUCKETS - 1;
+        s->count = 0;
+    }
+    return 0;
+}
+
+void uuidmap_destroy(uuidmap_t *map)
+{
+    for (int i = 0; i < UUIDMAP_STRIPES; i++)
+    {
+        pthread_mutex_destroy(&map->stripes[i].lock);
+        free(map->stripes[i].buckets);
+        map->stripes[i].buckets = NULL;
+    }
+}
+
+// doubles the buckets of a stripe; on failure the chains just get longer
+static void stripe_grow(uuidmap_stripe_t *s)
+{
+    size_t n = (s->mask + 1) * 2;
+    uuid_entry_t **buckets = calloc(n, sizeof(uuid_entry_t *));
+    if (!buckets)
+        return;
+
+    for (size_t i = 0; i <= s->mask; i++)
+    {
+        uuid_entry_t *e = s->buckets[i];
+        while (e)
+        {
+            uuid_entry_t *next = e->next;
+            uuid_entry_t **b = &buckets[e->hash & (n - 1)];
+            e->next = *b;
+            *b = e;
+            e = next;
+        }
+    }
+    free(s->buckets);
+    s->buckets = buckets;
+    s->mask = n - 1;
+}
+
+int uuidmap_insert(uuidmap_t *map, uuid_entry_t *entry)
+{
+    entry->hash = uuid_hash(entry->key);
+    uuidmap_stripe_t *s = stripe_of(map, entry->hash);
+
+    lock_take(&s->lock, LOCK_UUIDMAP);
+    uuid_entry_t **b = &s->buckets[entry->hash & s->mask];
+    for (uuid_entry_t *e = *b; e; e = e->next)
+    {
+        if (e->hash == entry->hash && uuid_compare(e->key, entry->key) == 0)
+        {
+            lock_drop(&s->lock);
+            return -1;
+        }
+    }
+    entry->next = *b;
+    *b = entry;
+    if (++s->count > s->mask + 1)
+        stripe_grow(s);
+    lock_drop(&s->lock);
+    return 0;
+}
+
+void uuidmap_remove(uuidmap_t *map, uuid_entry_t *entry)
+{
+    uuidmap_stripe_t *s = stripe_of(map, entry->hash);
+
+    lock_take(&s->lock, LOCK_UUIDMAP);
+    for (uuid_entry_t **p = &s->buckets[entry->hash & s->mask]; *p; p = &(*p)->next)
+    {
+        if (*p == entry)
+        {
+            *p = entry->next;
+            s->count--;
+            break;
+        }
+    }
+    lock_drop(&s->lock);
+    entry->next = NULL;
+}
+
+// must be called with the stripe locked
+static uuid_entry_t *stripe_find(uuidmap_stripe_t *s, uint64_t hash, const uuid_t key)
+{
+    uuid_entry_t *e = s->buckets[hash & s->mask];
+    while (e && (e->hash != hash || uuid_compare(e->key, key) != 0))
+        e = e->next;
+    return e;
+}
+
+void uuidmap_replace(uuidmap_t *map, uuid_entry_t *old, uuid_entry_t *entry)
+{
+    entry->hash = old->hash;
+    uuidmap_stripe_t *s = stripe_of(map, entry->hash);
+
+    lock_take(&s->lock, LOCK_UUIDMAP);
+    for (uuid_entry_t **p = &s->buckets[entry->hash & s->mask]; *p; p = &(*p)->next)
+    {
+        if (*p == old)
+        {
+            entry->next = old->next;
+            *p = entry;
+            break;
+        }
+    }
+    lock_drop(&s->lock);
+    old->next = NULL;
+}
+
+uuid_entry_t *uuidmap_find(uuidmap_t *map, const uuid_t key)
+{
+    uint64_t hash = uuid_hash(key);
+    uuidmap_stripe_t *s = stripe_of(map, hash);
+
+    lock_take(&s->lock, LOCK_UUIDMAP);
+    uuid_entry_t *e = stripe_find(s, hash, key);
+    lock_drop(&s->lock);
+    return e;
+}
+
+// the entry can't leave the map while the stripe is locked, so its
+// home is read before the owner gets the chance to recycle it
+int uuidmap_home(uuidmap_t *map, const uuid_t key)
+{
+    uint64_t hash = uuid_hash(key);
+    uuidmap_stripe_t *s = stripe_of(map, hash);
+
+    lock_take(&s->lock, LOCK_UUIDMAP);
+    uuid_entry_t *e = stripe_find(s, hash, key);
+    int home = e ? atomic_load(&e->home) : -1;
+    lock_drop(&s->lock);
+    return home;
+}
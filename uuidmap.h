@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <uuid/uuid.h>
+
+// concurrent hash map indexed by binary uuid. Entries are embedded in
+// the objects they index, so inserting and removing never allocate.
+// The table is split in stripes, each one with its own lock and its
+// own buckets, grown independently when they get too loaded
+#define UUIDMAP_STRIPES         16
+#define UUIDMAP_INITIAL_BUCKETS 64
+
+typedef struct uuid_entry_s
+{
+    uuid_t key;
+    uint64_t hash;
+    atomic_int home; // set by the owner, e.g. the thread running it
+    struct uuid_entry_s *next;
+} uuid_entry_t;
+
+typedef struct uuidmap_stripe_s
+{
+    pthread_mutex_t lock;
+    uuid_entry_t **buckets;
+    size_t mask;
+    size_t count;
+} uuidmap_stripe_t;
+
+typedef struct uuidmap_s
+{
+    uuidmap_stripe_t stripes[UUIDMAP_STRIPES];
+} uuidmap_t;
+
+int uuidmap_init(uuidmap_t *map);
+void uuidmap_destroy(uuidmap_t *map);
+
+// returns -1 when the key is already there
+int uuidmap_insert(uuidmap_t *map, uuid_entry_t *entry);
+void uuidmap_remove(uuidmap_t *map, uuid_entry_t *entry);
+
+// swaps an entry with another one with the same key, in one step
+void uuidmap_replace(uuidmap_t *map, uuid_entry_t *old, uuid_entry_t *entry);
+
+// the entry stays valid only as long as its owner keeps it in the map
+uuid_entry_t *uuidmap_find(uuidmap_t *map, const uuid_t key);
+
+// the home of the entry with that key, -1 if there is none. Unlike the
+// entry itself it can be asked for by any thread
+int uuidmap_home(uuidmap_t *map, const uuid_t key);
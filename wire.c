@@ -0,0 +1,113 @@
+#include <string.h>
+#include "wire.h"
+
+#define FRAME_HEADER_MAX 5
+
+// the length is only known once the payload is written: room for the
+// longest prefix is kept, then the frame is moved back after the real one
+static size_t frame_begin(evbuf_t *b, unsigned char op)
+{
+    size_t start = b->len;
+    static const unsigned char pad[FRAME_HEADER_MAX] = {0};
+    ev_bytes(b, pad, sizeof(pad));
+    ev_bytes(b, &op, 1);
+    return start;
+}
+
+static void frame_end(evbuf_t *b, size_t start)
+{
+    if (b->oom)
+        return;
+
+    size_t body = b->len - start - FRAME_HEADER_MAX;
+    unsigned char hdr[FRAME_HEADER_MAX];
+    size_t n = 0;
+    do
+    {
+        hdr[n] = (unsigned char)(body & 0x7f);
+        body >>= 7;
+        if (body)
+            hdr[n] |= 0x80;
+        n++;
+    } while (body);
+
+    char *dst = b->data + start;
+    memmove(dst + n, dst + FRAME_HEADER_MAX, b->len - start - FRAME_HEADER_MAX);
+    memcpy(dst, hdr, n);
+    b->len -= FRAME_HEADER_MAX - n;
+}
+
+evbuf_t *wire_json(const evbuf_t *json)
+{
+    evbuf_t *b = evbuf_get_bin();
+    size_t len = json->len;
+    if (len > 0 && json->data[len - 1] == '\n')
+        len--;
+
+    size_t start = frame_begin(b, WOP_JSON);
+    ev_bytes(b, json->data, len);
+    frame_end(b, start);
+    if (json->oom)
+        b->oom = 1;
+    return b;
+}
+
+evbuf_t *wire_words(const dict_t *dict, const uint32_t *words, int count)
+{
+    evbuf_t *b = evbuf_get_bin();
+    size_t start = frame_begin(b, WOP_WORDS);
+    ev_varint(b, (uint64_t)count);
+    for (int i = 0; i < count; i++)
+    {
+        size_t len = (size_t)dict_word_len(dict, (int)words[i]);
+        ev_varint(b, len);
+        ev_bytes(b, dict_word(dict, (int)words[i]), len);
+    }
+    frame_end(b, start);
+    return b;
+}
+
+evbuf_t *wire_scoreboard(const event_board_t *players, int count)
+{
+    evbuf_t *b = evbuf_get_bin();
+    size_t start = frame_begin(b, WOP_SCOREBOARD);
+    ev_varint(b, (uint64_t)count);
+    for (int i = 0; i < count; i++)
+    {
+        unsigned char mask = (unsigned char)players[i].mask;
+        ev_bytes(b, players[i].uuid_bin, sizeof(uuid_t));
+        ev_bytes(b, &mask, 1);
+        for (int f = 0; f < BOARD_FIELDS; f++)
+            if (mask & (1u << f))
+                ev_varint(b, (uint64_t)(players[i].values[f] > 0 ? players[i].values[f] : 0));
+    }
+    frame_end(b, start);
+    return b;
+}
+
+int wire_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value)
+{
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7)
+    {
+        unsigned char c = *(*p)++;
+        v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+        {
+            *value = v;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int wire_get_str(const unsigned char **p, const unsigned char *end, const char **str, size_t *len)
+{
+    uint64_t n;
+    if (!wire_get_varint(p, end, &n) || n > (uint64_t)(end - *p))
+        return 0;
+    *str = (const char *)*p;
+    *len = (size_t)n;
+    *p += n;
+    return 1;
+}
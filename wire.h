@@ -0,0 +1,35 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <uuid/uuid.h>
+#include "event.h"
+#include "dict.h"
+
+// compact binary protocol, asked for with "proto": "bin" in the JSON
+// handshake line. Everything after that line, in both directions and
+// errors included, is a sequence of frames:
+//
+//   varint length | opcode | payload
+//
+// where the length counts the opcode and the payload. Integers are
+// LEB128 varints, strings a varint length followed by the bytes (no NUL)
+
+// client -> server
+#define WOP_WORD       0x01 // varint word index, string typed
+#define WOP_DISCONNECT 0x02
+#define WOP_NEW_LOBBY  0x03
+#define WOP_KEYS       0x04 // string of keystrokes, '\b' deletes and ' ' submits
+
+// server -> client
+#define WOP_SCOREBOARD 0x81 // varint count, then 16 bytes uuid, byte mask, a varint per field in mask
+#define WOP_WORDS      0x82 // varint count, strings
+#define WOP_JSON       0xff // any other event, as its JSON text without "\n"
+
+// encoders write into the binary per-thread buffer
+evbuf_t *wire_json(const evbuf_t *json);
+evbuf_t *wire_words(const dict_t *dict, const uint32_t *words, int count);
+evbuf_t *wire_scoreboard(const event_board_t *players, int count);
+
+// decoders advance *p, and return 0 if the payload is truncated
+int wire_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value);
+int wire_get_str(const unsigned char **p, const unsigned char *end, const char **str, size_t *len);